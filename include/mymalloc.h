@@ -0,0 +1,65 @@
+/**
+ * @file mymalloc.h
+ * @brief The interface shared by the allocator backends.
+ *
+ * Every allocator exports its entry points under a prefix of its own, min_
+ * for the minimal allocator and my_ for the advanced one, and describes
+ * itself with a struct my_backend. Several backends can thus be linked into
+ * one program and picked by name at run time, e.g. to compare them on the
+ * same workload. Code that settles on a backend at compile time includes
+ * that backend's header and calls it directly, so it pays no indirect call.
+ */
+
+#ifndef MYMALLOC_H
+#define MYMALLOC_H
+
+#include <stddef.h>
+
+/**
+ * @brief The entry points and traits of one allocator backend.
+ */
+struct my_backend {
+    const char *name;                          ///< The name the registry knows it by.
+    const char *policy;                        ///< How it finds free memory, for reports.
+    int thread_safe;                           ///< Non-zero if threads may call it concurrently.
+    void *(*malloc)(size_t size);              ///< Allocates memory.
+    void (*free)(void *ptr);                   ///< Frees memory.
+    void *(*calloc)(size_t n, size_t s);       ///< Allocates zeroed memory.
+    void *(*realloc)(void *ptr, size_t size);  ///< Resizes memory.
+    void (*dump)(void);                        ///< Prints the heap to the console.
+};
+
+/**
+ * @brief The minimal allocator: a coalescing block list over a static 1 MB
+ * heap, searched first-fit, next-fit or best-fit as built.
+ */
+extern const struct my_backend my_backend_min;
+
+/**
+ * @brief The advanced allocator: TLSF bins, slab runs and per-thread caches.
+ */
+extern const struct my_backend my_backend_adv;
+
+/**
+ * @brief The C library's own malloc, as a baseline.
+ */
+extern const struct my_backend my_backend_libc;
+
+/**
+ * @brief Returns every backend of the registry.
+ *
+ * The registry links all backends in; programs that only need one should
+ * use that backend's struct directly instead.
+ *
+ * @return A NULL-terminated array of backends.
+ */
+const struct my_backend *const *my_backends(void);
+
+/**
+ * @brief Looks a backend up by name.
+ * @param name The backend's name, e.g. "adv".
+ * @return The backend, or NULL if there is none of that name.
+ */
+const struct my_backend *my_backend_find(const char *name);
+
+#endif // MYMALLOC_H
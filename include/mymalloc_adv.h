@@ -10,6 +10,159 @@
 #define MYMALLOC_ADV_H
 
 #include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief The my_mallopt parameter for the size from which requests are
+ * served by a private mmap mapping instead of the heap. Values above 2 GB
+ * are lowered to 2 GB, as no larger block fits the heap's bins.
+ */
+#define MY_M_MMAP_THRESHOLD 1
+
+/**
+ * @brief The my_mallopt parameter for the mean number of bytes allocated
+ * between two heap profile samples, or 0 to stop sampling.
+ */
+#define MY_M_PROFILE_RATE 2
+
+/**
+ * @brief The my_mallopt parameter for how many milliseconds a free heap
+ * block stays idle before its pages are returned to the kernel; 0 purges
+ * at every decay pass and SIZE_MAX never.
+ */
+#define MY_M_DECAY_MS 3
+
+/**
+ * @brief The my_mallopt parameter for the size of each NUMA node's first
+ * heap chunk, rounded up to 2 MB; sizes above 4 GB minus 2 MB are refused.
+ * Setting it maps the calling thread's node's chunk at once if the node has
+ * none yet, which together with MY_M_POPULATE moves the page faults of the
+ * heap to start-up.
+ */
+#define MY_M_HEAP_SIZE 4
+
+/**
+ * @brief The my_mallopt parameter that, when non-zero, pre-faults every heap
+ * chunk as it is mapped. Purging still returns idle pages, so set
+ * MY_M_DECAY_MS to SIZE_MAX as well to keep the heap resident.
+ */
+#define MY_M_POPULATE 5
+
+/**
+ * @brief The my_mallopt parameter for the pages backing new heap chunks:
+ * MY_HUGEPAGES_NONE, MY_HUGEPAGES_THP or MY_HUGEPAGES_EXPLICIT.
+ */
+#define MY_M_HUGEPAGES 6
+
+#define MY_HUGEPAGES_NONE 0      ///< Regular pages.
+#define MY_HUGEPAGES_THP 1       ///< Transparent 2 MB pages, asked for with MADV_HUGEPAGE.
+#define MY_HUGEPAGES_EXPLICIT 2  ///< 2 MB pages of the hugetlbfs pool, else transparent ones.
+
+/**
+ * @brief The number of first-level bins reported by my_malloc_stats.
+ */
+#define MY_STATS_BINS 25
+
+/**
+ * @brief The number of small size classes reported by my_malloc_stats.
+ */
+#define MY_STATS_CLASSES 20
+
+/**
+ * @brief The number of buckets of the bin search probe-length histogram.
+ */
+#define MY_STATS_PROBE_BUCKETS 8
+
+/**
+ * @brief Event counts for one first-level bin.
+ *
+ * Bin b holds free blocks of [2^(b+7), 2^(b+8)) bytes; bin 0 holds all
+ * blocks below 256 bytes.
+ */
+struct my_bin_stats {
+    size_t mallocs;      ///< Blocks of this bin's sizes carved from the bins.
+    size_t frees;        ///< Blocks of this bin's sizes returned to the bins.
+    size_t splits;       ///< Blocks of this bin's sizes split in two.
+    size_t coalesces;    ///< Merges that produced a block of this bin's sizes.
+};
+
+/**
+ * @brief Event counts for one small size class.
+ */
+struct my_class_stats {
+    size_t size;         ///< The object size of the class.
+    size_t mallocs;      ///< Objects of this class handed out.
+    size_t frees;        ///< Objects of this class freed.
+};
+
+/**
+ * @brief A snapshot of the allocator's statistics.
+ *
+ * Byte counts are for the whole process. Event counts are kept per thread
+ * and summed when the snapshot is taken, so they may be slightly behind
+ * threads that are running at the same time.
+ */
+struct my_stats {
+    size_t allocated;        ///< Bytes currently handed out, counting usable sizes.
+    size_t free;             ///< Bytes in free heap blocks, merged or waiting in fastbins.
+    size_t overhead;         ///< Bytes taken by block headers, chunk headers and sentinels.
+    size_t mapped;           ///< Bytes currently mapped from the OS, heap and huge.
+    size_t peak_mapped;      ///< The highest value mapped has reached.
+    size_t largest_free;     ///< The largest free heap block in bytes.
+    size_t purged;           ///< Bytes of free heap blocks returned to the kernel.
+    double fragmentation;    ///< 1 - largest_free / free, or 0 with no free memory.
+    struct my_bin_stats bins[MY_STATS_BINS];        ///< Block events by bin.
+    struct my_class_stats classes[MY_STATS_CLASSES]; ///< Small object events by class.
+    /// Bin searches by probe count: bucket i counts searches that looked at
+    /// [2^i, 2^(i+1)) bins or blocks, the last bucket everything above.
+    size_t probes[MY_STATS_PROBE_BUCKETS];
+};
+
+/**
+ * @brief The states a block can be in during a heap walk.
+ */
+enum my_block_state {
+    MY_BLOCK_USED,       ///< An allocated block.
+    MY_BLOCK_FREE,       ///< A free block waiting in a bin.
+    MY_BLOCK_RUN,        ///< A slab run carved into small objects.
+    MY_BLOCK_FAST        ///< A freed block waiting unmerged in a fastbin.
+};
+
+/**
+ * @brief One block visited by my_heap_walk.
+ */
+struct my_block_info {
+    int node;                    ///< The NUMA node that owns the block.
+    const void *chunk;           ///< The start of the chunk holding the block.
+    size_t offset;               ///< The offset of the block header in the chunk.
+    size_t size;                 ///< The payload size of the block.
+    enum my_block_state state;   ///< Whether the block is used, free or a run.
+    int bin;                     ///< The first-level bin of a free block, as in my_stats, or -1.
+    int size_class;              ///< The size class of a run, or -1.
+};
+
+/**
+ * @brief A callback invoked for every block of a heap walk.
+ * @param info The block. Only valid during the call.
+ * @param arg The argument given to my_heap_walk.
+ */
+typedef void (*my_heap_walker)(const struct my_block_info *info, void *arg);
+
+/**
+ * @brief A region whose allocations are bump-allocated and released together.
+ *
+ * Arenas are not thread safe; each one must be used by one thread at a time.
+ */
+typedef struct my_arena my_arena_t;
+
+/**
+ * @brief An independent heap, with chunks, bins and locks of its own.
+ *
+ * Heaps are thread safe. Their memory is never shared with the default heap
+ * of my_malloc or with other heaps, so tearing one down releases all of it
+ * at once.
+ */
+typedef struct my_heap my_heap_t;
 
 /**
  * @brief Allocates a block of memory of a given size.
@@ -18,12 +171,64 @@
  */
 void *my_malloc(size_t size);
 
+/**
+ * @brief Allocates memory backed by a given NUMA node.
+ *
+ * The memory may be freed from any thread with my_free; it always goes back
+ * to the node it came from.
+ *
+ * @param size The number of bytes to allocate.
+ * @param node The NUMA node number.
+ * @return A pointer to the allocated memory, or NULL if the allocation fails
+ *         or the node does not exist.
+ */
+void *my_malloc_onnode(size_t size, int node);
+
 /**
  * @brief Frees a previously allocated block of memory.
  * @param ptr A pointer to the memory to free.
  */
 void my_free(void *ptr);
 
+/**
+ * @brief Frees memory whose requested size the caller still knows.
+ *
+ * Small objects go straight back to their size class without any lookup.
+ * Memory from the aligned allocation functions must be freed with my_free.
+ *
+ * @param ptr A pointer returned by my_malloc, my_calloc or my_realloc.
+ * @param size The size that was requested for ptr.
+ */
+void my_free_sized(void *ptr, size_t size);
+
+/**
+ * @brief Returns the number of bytes usable at an allocated pointer.
+ * @param ptr A pointer returned by the allocator, or NULL.
+ * @return The usable size, at least the requested size, or 0 for NULL or
+ *         a pointer outside the heap.
+ */
+size_t my_malloc_usable_size(void *ptr);
+
+/**
+ * @brief Allocates many objects of the same size at once.
+ * @param size The number of bytes to allocate for each object.
+ * @param n The number of objects.
+ * @param out Receives the object pointers.
+ * @return The number of objects allocated; less than n if out of memory.
+ */
+size_t my_malloc_batch(size_t size, size_t n, void **out);
+
+/**
+ * @brief Frees many allocations at once.
+ *
+ * The pointers may also come from my_heap_malloc, on any heap, and are then
+ * taken off that heap's my_heap_allocated as by my_heap_free.
+ *
+ * @param ptrs The pointers to free; the array is reordered. NULLs are skipped.
+ * @param n The number of pointers.
+ */
+void my_free_batch(void **ptrs, size_t n);
+
 /**
  * @brief Allocates and zeros out a block of memory.
  * @param n The number of elements to allocate.
@@ -40,6 +245,252 @@ void *my_calloc(size_t n, size_t s);
  */
 void *my_realloc(void *ptr, size_t size);
 
+/**
+ * @brief Allocates memory aligned to a given boundary.
+ *
+ * Any padding needed in front of the aligned memory is returned to the heap.
+ *
+ * @param alignment The alignment, a power of two.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the aligned memory, or NULL on failure.
+ */
+void *my_aligned_alloc(size_t alignment, size_t size);
+
+/**
+ * @brief Allocates memory aligned to a given boundary.
+ * @param alignment The alignment, a power of two.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the aligned memory, or NULL on failure.
+ */
+void *my_memalign(size_t alignment, size_t size);
+
+/**
+ * @brief Allocates aligned memory, POSIX style.
+ * @param memptr Receives the pointer to the aligned memory.
+ * @param alignment The alignment, a power of two multiple of sizeof(void *).
+ * @param size The number of bytes to allocate.
+ * @return 0 on success, EINVAL for a bad alignment, ENOMEM if out of memory.
+ */
+int my_posix_memalign(void **memptr, size_t alignment, size_t size);
+
+/**
+ * @brief Allocates memory that shares no cache line with any other allocation.
+ *
+ * Meant for data that threads write concurrently, such as counters and
+ * queue nodes, where neighbouring allocations would cause false sharing.
+ * Plain small allocations of threads that run at the same time already never
+ * share a line, since each thread carves them from page-sized runs of its own.
+ *
+ * @param size The number of bytes to allocate, rounded up to whole lines.
+ * @return A pointer aligned to a cache line, or NULL on failure.
+ */
+void *my_malloc_isolated(size_t size);
+
+/**
+ * @brief Creates an arena.
+ * @param initial The capacity of the first chunk in bytes; 0 picks a default.
+ * @return The arena, or NULL if out of memory.
+ */
+my_arena_t *my_arena_create(size_t initial);
+
+/**
+ * @brief Allocates memory from an arena.
+ *
+ * The memory is aligned like my_malloc's but has no header. It must not be
+ * passed to my_free or my_realloc; it is released by my_arena_reset or
+ * my_arena_destroy.
+ *
+ * @param a The arena.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the memory, or NULL if out of memory.
+ */
+void *my_arena_alloc(my_arena_t *a, size_t size);
+
+/**
+ * @brief Releases every allocation of an arena at once, keeping the arena.
+ * @param a The arena.
+ */
+void my_arena_reset(my_arena_t *a);
+
+/**
+ * @brief Destroys an arena and releases all of its memory.
+ * @param a The arena, or NULL.
+ */
+void my_arena_destroy(my_arena_t *a);
+
+/**
+ * @brief Creates an independent heap.
+ *
+ * Its memory is bound to the NUMA node of the calling thread.
+ *
+ * @param size The capacity of its first chunk in bytes, at most 4 GB minus
+ *             2 MB; 0 picks a default.
+ * @return The heap, or NULL if out of memory or size is too large.
+ */
+my_heap_t *my_heap_create(size_t size);
+
+/**
+ * @brief Allocates memory from a heap.
+ *
+ * The memory is aligned like my_malloc's. It must be released with
+ * my_heap_free on the same heap, my_free_batch or my_heap_destroy, and not
+ * passed to my_free, my_realloc or the other calls of the default heap.
+ * Requests above 2 GB fail, as a heap has no huge mappings.
+ *
+ * @param h The heap.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the memory, or NULL if out of memory or size is too
+ *         large.
+ */
+void *my_heap_malloc(my_heap_t *h, size_t size);
+
+/**
+ * @brief Frees memory allocated from a heap.
+ * @param h The heap the memory came from.
+ * @param ptr A pointer returned by my_heap_malloc(h, ...), or NULL.
+ */
+void my_heap_free(my_heap_t *h, void *ptr);
+
+/**
+ * @brief Returns how much of a heap is in use.
+ *
+ * These bytes are not part of my_malloc_stats's allocated count, although
+ * the heap's chunks are part of its mapped count.
+ *
+ * @param h The heap.
+ * @return The usable bytes of its live allocations.
+ */
+size_t my_heap_allocated(const my_heap_t *h);
+
+/**
+ * @brief Destroys a heap and releases all of its memory, live or not.
+ *
+ * The cost does not depend on the number of live allocations.
+ *
+ * @param h The heap, or NULL.
+ */
+void my_heap_destroy(my_heap_t *h);
+
+/**
+ * @brief Adjusts a tunable parameter of the allocator.
+ *
+ * MY_M_HEAP_SIZE, MY_M_POPULATE and MY_M_HUGEPAGES can also be set before
+ * the program starts, from the MYMALLOC_HEAP_SIZE (bytes, with an optional
+ * k, m or g suffix), MYMALLOC_POPULATE (0 or 1) and MYMALLOC_HUGEPAGES
+ * (0, thp or explicit) environment variables, which are read on the first
+ * allocation.
+ *
+ * @param param The parameter to change, e.g. MY_M_MMAP_THRESHOLD.
+ * @param value The new value.
+ * @return 1 on success, 0 if the parameter or value is invalid.
+ */
+int my_mallopt(int param, size_t value);
+
+/**
+ * @brief Merges recently freed blocks that wait in fastbins.
+ *
+ * Freed blocks between the small size classes and 8 KB are kept unmerged
+ * for quick reuse and merged lazily. Call this from a background thread or
+ * a timer to hand their memory back to the bins sooner.
+ */
+void my_malloc_consolidate(void);
+
+/**
+ * @brief Returns the pages of long idle free blocks to the kernel.
+ *
+ * Every few frees the allocator checks whether free heap blocks have been
+ * idle longer than the MY_M_DECAY_MS time and purges their whole pages, so
+ * they no longer count towards the resident set. A program that frees
+ * rarely can call this from a background thread or a timer instead.
+ */
+void my_malloc_decay(void);
+
+/**
+ * @brief Fills in a snapshot of the allocator's statistics.
+ *
+ * Walks every heap chunk to measure free space, so it costs time in
+ * proportion to the heap size; the allocation paths only bump counters.
+ *
+ * @param st Receives the statistics.
+ */
+void my_malloc_stats(struct my_stats *st);
+
+/**
+ * @brief Visits every block of the heap in physical order.
+ *
+ * Chunks are walked one at a time with only their node's lock held, so other
+ * threads are held up for at most one chunk. The callback runs with that
+ * lock held and must not call into the allocator. Huge allocations are not
+ * part of any chunk and are not visited. The walk waits for the node locks,
+ * so it must not be called from a signal handler; see my_dump_json_fd.
+ *
+ * @param fn The callback.
+ * @param arg Passed to the callback.
+ */
+void my_heap_walk(my_heap_walker fn, void *arg);
+
+/**
+ * @brief Writes the physical heap layout as JSON.
+ *
+ * The output lists every block with its chunk, offset, size, state and bin,
+ * followed by a histogram of free blocks by power-of-two size and the totals
+ * it is derived from. The walk itself allocates nothing, and the stream is
+ * written to before any lock is taken, so it can set up its buffer safely
+ * even when this allocator is malloc. As it waits for the node locks and
+ * uses stdio, it must not be called from a signal handler.
+ *
+ * @param out The stream to write to.
+ */
+void my_dump_json(FILE *out);
+
+/**
+ * @brief Writes the physical heap layout as JSON, async-signal-safely.
+ *
+ * The output is that of my_dump_json, but it is formatted into buf and
+ * written with write(2), and the node locks are only tried: a node whose
+ * lock is busy, for instance because the signal interrupted its holder, is
+ * left out and counted in "skipped_nodes" rather than waited for.
+ *
+ * @param fd The file descriptor to write to.
+ * @param buf A buffer for the output; a few KB keep the writes few.
+ * @param len The size of buf.
+ * @return 1 if the whole heap was written, 0 if a node was skipped or a
+ *         write failed.
+ */
+int my_dump_json_fd(int fd, char *buf, size_t len);
+
+/**
+ * @brief Writes the sampled heap profile in the pprof legacy heap format.
+ *
+ * Enable sampling with my_mallopt(MY_M_PROFILE_RATE, bytes) first. Each
+ * allocation site gets its sampled in-use and cumulative object and byte
+ * counts, so `pprof -sample_index=inuse_space` shows the live heap and
+ * `-sample_index=alloc_space` all allocations since sampling began. The
+ * process's mappings follow for symbolization.
+ *
+ * @param out The stream to write to.
+ */
+void my_heap_profile_dump(FILE *out);
+
+/**
+ * @brief Starts tracing every allocation, free and realloc to a file.
+ *
+ * Each thread adds records to a ring of its own without locking and
+ * appends the ring to the file when it fills; the format is described in
+ * mymalloc_trace.h, and the benchmark suite replays such files. Setting
+ * MYMALLOC_TRACE to a path starts a trace on the first allocation. A trace
+ * still running at exit is written out then.
+ *
+ * @param path The file to write, truncated first.
+ * @return 1 on success, 0 if the file could not be written.
+ */
+int my_trace_start(const char *path);
+
+/**
+ * @brief Stops tracing and writes every thread's remaining records out.
+ */
+void my_trace_stop(void);
+
 /**
  * @brief Dumps the current state of the heap to the console.
  */
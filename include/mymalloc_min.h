@@ -3,31 +3,50 @@
  * @brief Header file for the minimal custom memory allocator.
  *
  * This file contains the function declarations for the minimal implementation
- * of a custom memory allocator.
+ * of a custom memory allocator. The functions are prefixed min_; unless
+ * MY_BACKEND_PREFIXED is defined, the usual my_ names map onto them, so a
+ * program built against this allocator alone calls it directly.
  */
 
 #ifndef MYMALLOC_MIN_H
 #define MYMALLOC_MIN_H
 
 #include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief One block visited by min_heap_walk.
+ */
+struct min_block_info {
+    size_t offset;       ///< The offset of the block header in the heap.
+    size_t size;         ///< The payload size of the block.
+    int free;            ///< 1 if the block is free, 0 if it is in use.
+};
+
+/**
+ * @brief A callback invoked for every block of a heap walk.
+ * @param info The block. Only valid during the call.
+ * @param arg The argument given to min_heap_walk.
+ */
+typedef void (*min_heap_walker)(const struct min_block_info *info, void *arg);
 
 /**
  * @brief Initializes the heap.
  */
-void my_init(void);
+void min_init(void);
 
 /**
  * @brief Allocates a block of memory of a given size.
  * @param size The number of bytes to allocate.
  * @return A pointer to the allocated memory, or NULL if the allocation fails.
  */
-void *my_malloc(size_t size);
+void *min_malloc(size_t size);
 
 /**
  * @brief Frees a previously allocated block of memory.
  * @param ptr A pointer to the memory to free.
  */
-void my_free(void *ptr);
+void min_free(void *ptr);
 
 /**
  * @brief Allocates and zeros out a block of memory.
@@ -35,7 +54,7 @@ void my_free(void *ptr);
  * @param s The size of each element.
  * @return A pointer to the allocated and zeroed memory, or NULL on failure.
  */
-void *my_calloc(size_t n, size_t s);
+void *min_calloc(size_t n, size_t s);
 
 /**
  * @brief Resizes a previously allocated block of memory.
@@ -43,11 +62,41 @@ void *my_calloc(size_t n, size_t s);
  * @param size The new size of the memory block.
  * @return A pointer to the resized memory block, or NULL on failure.
  */
-void *my_realloc(void *ptr, size_t size);
+void *min_realloc(void *ptr, size_t size);
+
+/**
+ * @brief Visits every block of the heap in physical order.
+ * @param fn The callback, which must not call into the allocator.
+ * @param arg Passed to the callback.
+ */
+void min_heap_walk(min_heap_walker fn, void *arg);
+
+/**
+ * @brief Writes the physical heap layout as JSON.
+ *
+ * The output lists every block with its offset, size and state, followed by
+ * a histogram of free blocks by power-of-two size.
+ *
+ * @param out The stream to write to.
+ */
+void min_dump_json(FILE *out);
 
 /**
  * @brief Dumps the current state of the heap to the console.
  */
-void my_dump(void);
+void min_dump(void);
+
+#ifndef MY_BACKEND_PREFIXED
+#define my_block_info min_block_info
+#define my_heap_walker min_heap_walker
+#define my_init min_init
+#define my_malloc min_malloc
+#define my_free min_free
+#define my_calloc min_calloc
+#define my_realloc min_realloc
+#define my_heap_walk min_heap_walk
+#define my_dump_json min_dump_json
+#define my_dump min_dump
+#endif
 
 #endif // MYMALLOC_MIN_H
\ No newline at end of file
@@ -0,0 +1,50 @@
+/**
+ * @file mymalloc_trace.h
+ * @brief The binary format of the advanced allocator's allocation traces.
+ *
+ * A trace starts with a struct my_trace_header and continues with struct
+ * my_trace_record entries in host byte order. Every thread writes its
+ * records in batches of its own, so records are in time order within a
+ * thread but not across threads; readers sort by time first. The benchmark
+ * suite replays such files like .rep traces.
+ */
+
+#ifndef MYMALLOC_TRACE_H
+#define MYMALLOC_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * @brief The magic bytes that start a trace, including the format version.
+ */
+#define MY_TRACE_MAGIC "MYTRACE1"
+
+/**
+ * @brief The kinds of traced operation.
+ */
+enum {
+    MY_TRACE_MALLOC,   ///< ptr was allocated with size bytes, by any allocating call.
+    MY_TRACE_FREE,     ///< ptr was freed.
+    MY_TRACE_REALLOC,  ///< old was resized to size bytes and now lives at ptr.
+};
+
+/**
+ * @brief The start of a trace file.
+ */
+struct my_trace_header {
+    char magic[8];     ///< MY_TRACE_MAGIC, without the terminating NUL.
+};
+
+/**
+ * @brief One traced operation.
+ */
+struct my_trace_record {
+    uint64_t time;     ///< Nanoseconds since the trace started.
+    uint64_t ptr;      ///< The pointer allocated, freed or returned by realloc.
+    uint64_t old;      ///< The pointer given to realloc, or 0.
+    uint64_t size;     ///< The requested size; 0 for frees.
+    uint32_t thread;   ///< The traced thread, numbered from 0 in the order threads first traced.
+    uint32_t op;       ///< MY_TRACE_MALLOC, MY_TRACE_FREE or MY_TRACE_REALLOC.
+};
+
+#endif // MYMALLOC_TRACE_H
@@ -0,0 +1,882 @@
+/**
+ * @file bench.c
+ * @brief A benchmark suite for the custom allocators and the system malloc.
+ *
+ * The same source is built three times: against the minimal allocator, against
+ * the advanced allocator (ADVANCED_ALLOCATOR) and against glibc
+ * (SYSTEM_ALLOCATOR), so the numbers of the three binaries are directly
+ * comparable. Built with BACKEND_REGISTRY instead, it links all backends and
+ * runs each one picked with -a through its struct my_backend, at the cost of
+ * an indirect call per operation.
+ *
+ * Each workload runs in a forked child process, which gives the minimal
+ * allocator a fresh static heap every time and lets the resident set of one
+ * workload be measured without the memory the previous ones left behind. For
+ * every workload the suite reports throughput, p50/p99/p999 latency of each
+ * kind of operation, the peak resident set size, and utilization: the peak of
+ * the requested bytes live at once divided by the growth of the resident set.
+ *
+ * Besides the synthetic workloads, traces given on the command line are
+ * replayed: files in the CMU malloclab .rep format, and allocation traces
+ * recorded by the advanced allocator (see mymalloc_trace.h), whose threads'
+ * operations are replayed on one thread in the order they happened.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "mymalloc_trace.h"
+
+#if defined(BACKEND_REGISTRY)
+#include "mymalloc.h"
+// The backend being measured.
+static const struct my_backend *backend;
+#define ALLOCATOR_NAME backend->name
+#define my_malloc(size) backend->malloc(size)
+#define my_free(ptr) backend->free(ptr)
+#define my_realloc(ptr, size) backend->realloc(ptr, size)
+#elif defined(ADVANCED_ALLOCATOR)
+#include "mymalloc_adv.h"
+#define ALLOCATOR_NAME "adv"
+#elif defined(SYSTEM_ALLOCATOR)
+#define ALLOCATOR_NAME "glibc"
+#define my_malloc malloc
+#define my_free free
+#define my_realloc realloc
+#else
+#include "mymalloc_min.h"
+#define ALLOCATOR_NAME "min"
+#endif
+
+#if defined(BACKEND_REGISTRY)
+// Every backend gets the workload the minimal allocator can handle, so that
+// their lines compare. Threaded workloads are built in but skipped for
+// backends that are not thread-safe.
+#define THREAD_SAFE 1
+#define BACKEND_THREAD_SAFE (backend->thread_safe)
+#define DEFAULT_OPS 40000
+#define DEFAULT_LIVE 400
+#define REALLOC_MAX (16 * 1024)
+#elif defined(ADVANCED_ALLOCATOR) || defined(SYSTEM_ALLOCATOR)
+// Whether the allocator may be called from several threads at once.
+#define THREAD_SAFE 1
+// The default number of operations per workload and of objects live at once.
+#define DEFAULT_OPS 400000
+#define DEFAULT_LIVE 4000
+// The size realloc-growth buffers grow to before they are freed.
+#define REALLOC_MAX (256 * 1024)
+#else
+// The minimal allocator is single-threaded and carves everything from a
+// static 1 MB heap, so it gets a smaller workload.
+#define THREAD_SAFE 0
+#define DEFAULT_OPS 40000
+#define DEFAULT_LIVE 400
+#define REALLOC_MAX (16 * 1024)
+#endif
+#ifndef BACKEND_THREAD_SAFE
+#define BACKEND_THREAD_SAFE THREAD_SAFE
+#endif
+
+// The number of threads of the larson workload and of pairs of the
+// producer-consumer workload.
+#define THREADS 4
+// The number of rounds after which larson threads swap their objects.
+#define LARSON_ROUNDS 8
+// The capacity of a producer-consumer ring; a power of two.
+#define RING_SIZE 1024
+// Latency histogram buckets: 16 linear sub-buckets per power of two.
+#define HIST_SUB 16
+#define HIST_POWERS 64
+
+/**
+ * @brief The kinds of operation whose latency is measured.
+ */
+enum { OP_MALLOC, OP_FREE, OP_REALLOC, OP_KINDS };
+
+// The names of the operation kinds, for the report.
+static const char *const op_names[OP_KINDS] = { "malloc", "free", "realloc" };
+
+/**
+ * @brief A log-linear histogram of latencies in nanoseconds.
+ *
+ * Values below HIST_SUB have a bucket each; above that every power of two is
+ * split into HIST_SUB buckets, so any percentile is exact to within 1/16.
+ */
+typedef struct Hist {
+    uint64_t count[HIST_POWERS][HIST_SUB];
+    uint64_t total;
+} Hist;
+
+/**
+ * @brief The state of one benchmark thread.
+ */
+typedef struct Worker {
+    int id;                      ///< The thread index.
+    uint64_t rng;                ///< xorshift state.
+    size_t ops;                  ///< The operations performed.
+    size_t failed;               ///< The allocations that returned NULL.
+    Hist hist[OP_KINDS];         ///< Latencies by kind of operation.
+} Worker;
+
+/**
+ * @brief A benchmark workload.
+ */
+typedef struct Workload {
+    const char *name;            ///< The name printed in the report.
+    void (*run)(const char *arg);///< Runs the workload with all operations timed.
+    int threaded;                ///< Non-zero if it calls the allocator from several threads.
+} Workload;
+
+// The number of operations per workload and of objects live at once.
+static size_t num_ops = DEFAULT_OPS;
+static size_t num_live = DEFAULT_LIVE;
+// 1 to print comma-separated values instead of a table.
+static int csv;
+// One worker per thread. Static, so they are resident before measuring.
+static Worker workers[2 * THREADS];
+// The requested bytes currently live and their peak.
+static _Atomic size_t live_bytes;
+static _Atomic size_t peak_live;
+
+/**
+ * @brief Returns a monotonic timestamp.
+ * @return The time in nanoseconds.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Returns the next pseudo-random number of a worker.
+ * @param w The worker.
+ * @return A 64-bit pseudo-random number.
+ */
+static uint64_t next_rand(Worker *w) {
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    return w->rng;
+}
+
+/**
+ * @brief Picks a request size, skewed towards small sizes as real programs are.
+ * @param w The worker.
+ * @return A size between 1 and 4096.
+ */
+static size_t rand_size(Worker *w) {
+    uint64_t x = next_rand(w);
+    return 1 + (size_t)(x % ((size_t)16 << ((x >> 40) % 9)));
+}
+
+/**
+ * @brief Adds a latency to a histogram.
+ * @param h The histogram.
+ * @param ns The latency in nanoseconds.
+ */
+static void hist_add(Hist *h, uint64_t ns) {
+    if (ns < HIST_SUB) {
+        h->count[0][ns]++;
+    } else {
+        int p = 63 - __builtin_clzll(ns);
+        h->count[p - 3][(ns >> (p - 4)) & (HIST_SUB - 1)]++;
+    }
+    h->total++;
+}
+
+/**
+ * @brief Returns the lower bound of a histogram bucket.
+ * @param e The power index.
+ * @param s The sub-bucket.
+ * @return The smallest latency the bucket holds.
+ */
+static uint64_t hist_value(int e, int s) {
+    return e ? (uint64_t)(HIST_SUB + s) << (e - 1) : (uint64_t)s;
+}
+
+/**
+ * @brief Returns a percentile of a histogram.
+ * @param h The histogram.
+ * @param q The quantile, between 0 and 1.
+ * @return The latency below which a fraction q of the samples lie.
+ */
+static uint64_t hist_percentile(const Hist *h, double q) {
+    uint64_t rank = (uint64_t)(q * (double)(h->total - 1)), seen = 0;
+    for (int e = 0; e < HIST_POWERS; e++) {
+        for (int s = 0; s < HIST_SUB; s++) {
+            seen += h->count[e][s];
+            if (seen > rank) return hist_value(e, s);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds the counts of one histogram to another.
+ * @param dst The histogram added to.
+ * @param src The histogram added.
+ */
+static void hist_merge(Hist *dst, const Hist *src) {
+    for (int e = 0; e < HIST_POWERS; e++) {
+        for (int s = 0; s < HIST_SUB; s++) dst->count[e][s] += src->count[e][s];
+    }
+    dst->total += src->total;
+}
+
+/**
+ * @brief Tracks the requested bytes that are live.
+ * @param add The bytes allocated.
+ * @param sub The bytes freed.
+ */
+static void live_update(size_t add, size_t sub) {
+    size_t now = atomic_fetch_add_explicit(&live_bytes, add - sub, memory_order_relaxed) + add - sub;
+    size_t peak = atomic_load_explicit(&peak_live, memory_order_relaxed);
+    while (now > peak && !atomic_compare_exchange_weak_explicit(&peak_live, &peak, now,
+                                                                memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief Allocates and records the latency.
+ * @param w The calling worker.
+ * @param size The request size.
+ * @return The allocation, or NULL.
+ */
+static void *timed_malloc(Worker *w, size_t size) {
+    uint64_t t = now_ns();
+    void *p = my_malloc(size);
+    hist_add(&w->hist[OP_MALLOC], now_ns() - t);
+    w->ops++;
+    if (p) live_update(size, 0);
+    else w->failed++;
+    return p;
+}
+
+/**
+ * @brief Frees and records the latency.
+ * @param w The calling worker.
+ * @param p The allocation, or NULL to do nothing.
+ * @param size The size it was requested with.
+ */
+static void timed_free(Worker *w, void *p, size_t size) {
+    if (!p) return;
+    uint64_t t = now_ns();
+    my_free(p);
+    hist_add(&w->hist[OP_FREE], now_ns() - t);
+    w->ops++;
+    live_update(0, size);
+}
+
+/**
+ * @brief Reallocates and records the latency.
+ * @param w The calling worker.
+ * @param p The allocation, or NULL.
+ * @param old The size p was requested with.
+ * @param size The new size.
+ * @return The new allocation, or NULL, in which case p is still valid.
+ */
+static void *timed_realloc(Worker *w, void *p, size_t old, size_t size) {
+    uint64_t t = now_ns();
+    void *q = my_realloc(p, size);
+    hist_add(&w->hist[OP_REALLOC], now_ns() - t);
+    w->ops++;
+    if (q) live_update(size, old);
+    else w->failed++;
+    return q;
+}
+
+/**
+ * @brief Maps zeroed memory for bookkeeping that is not part of the measurement.
+ * @param size The number of bytes.
+ * @return The memory, already resident.
+ */
+static void *scratch(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("bench: mmap");
+        exit(1);
+    }
+    return p;
+}
+
+/**
+ * @brief Allocates a batch of objects and frees them in reverse order.
+ * @param arg Unused.
+ */
+static void run_lifo(const char *arg) {
+    (void)arg;
+    Worker *w = &workers[0];
+    void **ptrs = scratch(num_live * sizeof(void*));
+    size_t *sizes = scratch(num_live * sizeof(size_t));
+    while (w->ops < num_ops) {
+        for (size_t i = 0; i < num_live; i++) ptrs[i] = timed_malloc(w, sizes[i] = rand_size(w));
+        for (size_t i = num_live; i-- > 0;) timed_free(w, ptrs[i], sizes[i]);
+    }
+}
+
+/**
+ * @brief Allocates a batch of objects and frees them in allocation order.
+ * @param arg Unused.
+ */
+static void run_fifo(const char *arg) {
+    (void)arg;
+    Worker *w = &workers[0];
+    void **ptrs = scratch(num_live * sizeof(void*));
+    size_t *sizes = scratch(num_live * sizeof(size_t));
+    while (w->ops < num_ops) {
+        for (size_t i = 0; i < num_live; i++) ptrs[i] = timed_malloc(w, sizes[i] = rand_size(w));
+        for (size_t i = 0; i < num_live; i++) timed_free(w, ptrs[i], sizes[i]);
+    }
+}
+
+/**
+ * @brief Allocates or frees a random slot on every step, so lifetimes vary.
+ * @param arg Unused.
+ */
+static void run_random(const char *arg) {
+    (void)arg;
+    Worker *w = &workers[0];
+    void **ptrs = scratch(num_live * sizeof(void*));
+    size_t *sizes = scratch(num_live * sizeof(size_t));
+    while (w->ops < num_ops) {
+        size_t i = next_rand(w) % num_live;
+        if (ptrs[i]) {
+            timed_free(w, ptrs[i], sizes[i]);
+            ptrs[i] = NULL;
+        } else {
+            ptrs[i] = timed_malloc(w, sizes[i] = rand_size(w));
+        }
+    }
+    for (size_t i = 0; i < num_live; i++) timed_free(w, ptrs[i], sizes[i]);
+}
+
+/**
+ * @brief Grows buffers step by step with realloc, as string builders do.
+ * @param arg Unused.
+ */
+static void run_realloc(const char *arg) {
+    (void)arg;
+    Worker *w = &workers[0];
+    size_t count = num_live / 50 ? num_live / 50 : 1;
+    void **ptrs = scratch(count * sizeof(void*));
+    size_t *sizes = scratch(count * sizeof(size_t));
+    while (w->ops < num_ops) {
+        // Interleave the buffers so that they get in each other's way.
+        for (size_t i = 0; i < count; i++) {
+            size_t size = sizes[i] ? sizes[i] + sizes[i] / 2 + next_rand(w) % 64 : 16;
+            if (size > REALLOC_MAX) {
+                timed_free(w, ptrs[i], sizes[i]);
+                ptrs[i] = NULL;
+                sizes[i] = 0;
+                continue;
+            }
+            void *p = timed_realloc(w, ptrs[i], sizes[i], size);
+            if (p) {
+                ptrs[i] = p;
+                sizes[i] = size;
+            }
+        }
+    }
+    for (size_t i = 0; i < count; i++) timed_free(w, ptrs[i], sizes[i]);
+}
+
+/**
+ * @brief One operation of a trace, on the allocation of a given id.
+ */
+typedef struct TraceOp {
+    char kind;                   ///< 'a' to allocate, 'r' to reallocate, 'f' to free.
+    long id;                     ///< The allocation, from 0 to the trace's id count.
+    size_t size;                 ///< The size to allocate or reallocate to.
+} TraceOp;
+
+/**
+ * @brief Parses a CMU malloclab .rep trace.
+ *
+ * The header gives the suggested heap size, the number of ids, the number of
+ * operations and a weight; each following line is "a id size", "r id size"
+ * or "f id".
+ *
+ * @param f The open trace.
+ * @param path Its name, for errors.
+ * @param ids Receives the number of ids.
+ * @param ops Receives the number of operations.
+ * @return The operations.
+ */
+static TraceOp *parse_rep(FILE *f, const char *path, long *ids, long *ops) {
+    long heap, weight;
+    if (fscanf(f, "%ld %ld %ld %ld", &heap, ids, ops, &weight) != 4 || *ids <= 0 || *ops < 0) {
+        fprintf(stderr, "bench: %s: bad header\n", path);
+        exit(1);
+    }
+    TraceOp *trace = scratch((size_t)*ops * sizeof(TraceOp) + 1);
+    for (long i = 0; i < *ops; i++) {
+        TraceOp *op = &trace[i];
+        if (fscanf(f, " %c %ld", &op->kind, &op->id) != 2 || op->id < 0 || op->id >= *ids
+            || (op->kind != 'f' && fscanf(f, "%zu", &op->size) != 1)) {
+            fprintf(stderr, "bench: %s: bad operation %ld\n", path, i);
+            exit(1);
+        }
+    }
+    return trace;
+}
+
+/**
+ * @brief Orders trace records by time, then by thread, for qsort.
+ * @param a A pointer to the first record.
+ * @param b A pointer to the second record.
+ * @return A negative, zero or positive value like strcmp.
+ */
+static int compare_records(const void *a, const void *b) {
+    const struct my_trace_record *x = a, *y = b;
+    if (x->time != y->time) return x->time < y->time ? -1 : 1;
+    return (x->thread > y->thread) - (x->thread < y->thread);
+}
+
+/**
+ * @brief An entry of the table from live addresses to ids.
+ */
+typedef struct AddrSlot {
+    uint64_t addr;               ///< The address; 0 if never used, 1 once removed.
+    long id;                     ///< The id of the allocation at addr.
+} AddrSlot;
+
+/**
+ * @brief Finds the slot of an address, or where it would go.
+ * @param table The table, with mask + 1 slots.
+ * @param mask The slot count minus one.
+ * @param addr The address, above 1.
+ * @param insert Non-zero to return the first reusable slot if addr is absent.
+ * @return The slot holding addr, the slot to insert it in, or NULL.
+ */
+static AddrSlot *addr_slot(AddrSlot *table, size_t mask, uint64_t addr, int insert) {
+    AddrSlot *free_slot = NULL;
+    for (size_t i = (size_t)((addr >> 4) * 0x9e3779b97f4a7c15ULL) & mask;; i = (i + 1) & mask) {
+        AddrSlot *sl = &table[i];
+        if (sl->addr == addr) return sl;
+        if (sl->addr == 1 && !free_slot) free_slot = sl;
+        if (!sl->addr) return insert ? (free_slot ? free_slot : sl) : NULL;
+    }
+}
+
+/**
+ * @brief Converts an allocation trace of the advanced allocator into operations.
+ *
+ * Addresses become ids, as in .rep traces. Frees and reallocs of memory
+ * allocated before the trace started have no id; the frees are dropped and
+ * the reallocs become allocations.
+ *
+ * @param f The open trace, positioned after the header.
+ * @param path Its name, for errors.
+ * @param ids Receives the number of ids.
+ * @param ops Receives the number of operations.
+ * @return The operations.
+ */
+static TraceOp *parse_mytrace(FILE *f, const char *path, long *ids, long *ops) {
+    long start = ftell(f);
+    fseek(f, 0, SEEK_END);
+    size_t n = (size_t)(ftell(f) - start) / sizeof(struct my_trace_record);
+    fseek(f, start, SEEK_SET);
+    struct my_trace_record *recs = scratch(n * sizeof(*recs) + 1);
+    if (fread(recs, sizeof(*recs), n, f) != n) {
+        fprintf(stderr, "bench: %s: truncated trace\n", path);
+        exit(1);
+    }
+    qsort(recs, n, sizeof(*recs), compare_records);
+
+    size_t slots = 16;
+    while (slots < 2 * n) slots *= 2;
+    AddrSlot *table = scratch(slots * sizeof(AddrSlot));
+    TraceOp *trace = scratch(n * sizeof(TraceOp) + 1);
+    *ids = 0;
+    *ops = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct my_trace_record *r = &recs[i];
+        AddrSlot *sl;
+        TraceOp *op = &trace[*ops];
+        switch (r->op) {
+        case MY_TRACE_MALLOC:
+            sl = addr_slot(table, slots - 1, r->ptr, 1);
+            *op = (TraceOp){ 'a', *ids, r->size };
+            break;
+        case MY_TRACE_FREE:
+            if (!(sl = addr_slot(table, slots - 1, r->ptr, 0))) continue;
+            *op = (TraceOp){ 'f', sl->id, 0 };
+            sl->addr = 1;
+            (*ops)++;
+            continue;
+        case MY_TRACE_REALLOC:
+            sl = r->old ? addr_slot(table, slots - 1, r->old, 0) : NULL;
+            if (sl) {
+                *op = (TraceOp){ 'r', sl->id, r->size };
+                sl->addr = 1;
+            } else {
+                *op = (TraceOp){ 'a', *ids, r->size };
+            }
+            sl = addr_slot(table, slots - 1, r->ptr, 1);
+            break;
+        default:
+            fprintf(stderr, "bench: %s: bad operation %zu\n", path, i);
+            exit(1);
+        }
+        if (op->kind == 'a') (*ids)++;
+        sl->addr = r->ptr;
+        sl->id = op->id;
+        (*ops)++;
+    }
+    if (!*ids) *ids = 1;
+    return trace;
+}
+
+/**
+ * @brief Replays a trace, either a CMU malloclab .rep file or an allocation
+ *        trace of the advanced allocator.
+ * @param path The trace file.
+ */
+static void run_trace(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "bench: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    // Parse the whole trace first so that only the replay is timed.
+    long ids, ops;
+    struct my_trace_header header;
+    TraceOp *trace;
+    if (fread(&header, sizeof(header), 1, f) == 1 && !memcmp(header.magic, MY_TRACE_MAGIC, sizeof(header.magic))) {
+        trace = parse_mytrace(f, path, &ids, &ops);
+    } else {
+        rewind(f);
+        trace = parse_rep(f, path, &ids, &ops);
+    }
+    fclose(f);
+
+    Worker *w = &workers[0];
+    void **ptrs = scratch((size_t)ids * sizeof(void*));
+    size_t *sizes = scratch((size_t)ids * sizeof(size_t));
+    for (long i = 0; i < ops; i++) {
+        TraceOp *op = &trace[i];
+        switch (op->kind) {
+        case 'a':
+            ptrs[op->id] = timed_malloc(w, op->size);
+            sizes[op->id] = op->size;
+            break;
+        case 'r': {
+            void *p = timed_realloc(w, ptrs[op->id], sizes[op->id], op->size);
+            if (p) {
+                ptrs[op->id] = p;
+                sizes[op->id] = op->size;
+            }
+            break;
+        }
+        default:
+            timed_free(w, ptrs[op->id], sizes[op->id]);
+            ptrs[op->id] = NULL;
+            break;
+        }
+    }
+    for (long i = 0; i < ids; i++) timed_free(w, ptrs[i], sizes[i]);
+}
+
+#if THREAD_SAFE
+/**
+ * @brief A single-producer, single-consumer ring of allocations in flight.
+ */
+typedef struct Ring {
+    void *ptrs[RING_SIZE];
+    size_t sizes[RING_SIZE];
+    _Atomic size_t head;         ///< The next slot the consumer reads.
+    _Atomic size_t tail;         ///< The next slot the producer writes.
+} Ring;
+
+// One ring per producer-consumer pair.
+static Ring rings[THREADS];
+// The barrier between larson rounds.
+static pthread_barrier_t larson_barrier;
+// The objects of each larson thread, swapped between rounds.
+static void **larson_ptrs[THREADS];
+static size_t *larson_sizes[THREADS];
+
+/**
+ * @brief Allocates objects and hands them to a consumer thread.
+ * @param arg The producer's worker.
+ * @return NULL.
+ */
+static void *producer(void *arg) {
+    Worker *w = arg;
+    Ring *r = &rings[w->id];
+    for (size_t n = 0; n < num_ops / (2 * THREADS); n++) {
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        while (tail - atomic_load_explicit(&r->head, memory_order_acquire) == RING_SIZE) sched_yield();
+        size_t size = rand_size(w);
+        r->ptrs[tail % RING_SIZE] = timed_malloc(w, size);
+        r->sizes[tail % RING_SIZE] = size;
+        atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Frees the objects a producer thread hands over.
+ * @param arg The consumer's worker.
+ * @return NULL.
+ */
+static void *consumer(void *arg) {
+    Worker *w = arg;
+    Ring *r = &rings[w->id - THREADS];
+    for (size_t n = 0; n < num_ops / (2 * THREADS); n++) {
+        size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        while (atomic_load_explicit(&r->tail, memory_order_acquire) == head) sched_yield();
+        timed_free(w, r->ptrs[head % RING_SIZE], r->sizes[head % RING_SIZE]);
+        atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Replaces random objects, passing each thread's objects on every round.
+ *
+ * This is the larson server benchmark: objects are allocated by one thread
+ * and freed by another, as with requests handed between worker threads.
+ *
+ * @param arg The thread's worker.
+ * @return NULL.
+ */
+static void *larson(void *arg) {
+    Worker *w = arg;
+    size_t slots = num_live / THREADS;
+    for (int round = 0; round < LARSON_ROUNDS; round++) {
+        void **ptrs = larson_ptrs[(w->id + round) % THREADS];
+        size_t *sizes = larson_sizes[(w->id + round) % THREADS];
+        for (size_t n = 0; n < num_ops / (2 * THREADS * LARSON_ROUNDS); n++) {
+            size_t i = next_rand(w) % slots;
+            timed_free(w, ptrs[i], sizes[i]);
+            ptrs[i] = timed_malloc(w, sizes[i] = rand_size(w));
+        }
+        pthread_barrier_wait(&larson_barrier);
+    }
+    void **ptrs = larson_ptrs[w->id];
+    for (size_t i = 0; i < slots; i++) timed_free(w, ptrs[i], larson_sizes[w->id][i]);
+    return NULL;
+}
+
+/**
+ * @brief Runs the producer-consumer workload.
+ * @param arg Unused.
+ */
+static void run_prodcons(const char *arg) {
+    (void)arg;
+    pthread_t t[2 * THREADS];
+    for (int i = 0; i < 2 * THREADS; i++) {
+        pthread_create(&t[i], NULL, i < THREADS ? producer : consumer, &workers[i]);
+    }
+    for (int i = 0; i < 2 * THREADS; i++) pthread_join(t[i], NULL);
+}
+
+/**
+ * @brief Runs the larson workload.
+ * @param arg Unused.
+ */
+static void run_larson(const char *arg) {
+    (void)arg;
+    pthread_t t[THREADS];
+    pthread_barrier_init(&larson_barrier, NULL, THREADS);
+    for (int i = 0; i < THREADS; i++) {
+        larson_ptrs[i] = scratch(num_live / THREADS * sizeof(void*));
+        larson_sizes[i] = scratch(num_live / THREADS * sizeof(size_t));
+    }
+    for (int i = 0; i < THREADS; i++) pthread_create(&t[i], NULL, larson, &workers[i]);
+    for (int i = 0; i < THREADS; i++) pthread_join(t[i], NULL);
+    pthread_barrier_destroy(&larson_barrier);
+}
+#endif
+
+// The synthetic workloads, in the order they are run.
+static const Workload workloads[] = {
+    { "lifo", run_lifo, 0 },
+    { "fifo", run_fifo, 0 },
+    { "random", run_random, 0 },
+    { "realloc", run_realloc, 0 },
+#if THREAD_SAFE
+    { "prodcons", run_prodcons, 1 },
+    { "larson", run_larson, 1 },
+#endif
+};
+
+/**
+ * @brief Reads a size field of /proc/self/status.
+ * @param field The field name including the colon, e.g. "VmHWM:".
+ * @return The value in kB, or 0 if it is not available.
+ */
+static long status_kb(const char *field) {
+    char buf[4096];
+    int fd = open("/proc/self/status", O_RDONLY);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    char *p = strstr(buf, field);
+    return p ? strtol(p + strlen(field), NULL, 10) : 0;
+}
+
+/**
+ * @brief Runs one workload and prints a report line per kind of operation.
+ *
+ * The peak resident set is reset first, so the reported peak and the
+ * utilization belong to this workload alone.
+ *
+ * @param name The workload name.
+ * @param run The workload.
+ * @param arg The workload's argument.
+ */
+static void measure(const char *name, void (*run)(const char *), const char *arg) {
+    for (int i = 0; i < 2 * THREADS; i++) {
+        memset(&workers[i], 0, sizeof(Worker));
+        workers[i].id = i;
+        workers[i].rng = 0x9e3779b97f4a7c15ULL * (uint64_t)(i + 1);
+    }
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd >= 0) {
+        if (write(fd, "5", 1) < 0) perror("bench: clear_refs");
+        close(fd);
+    }
+    long base = status_kb("VmRSS:");
+
+    uint64_t start = now_ns();
+    run(arg);
+    double secs = (double)(now_ns() - start) / 1e9;
+
+    long hwm = status_kb("VmHWM:");
+    size_t ops = 0, failed = 0;
+    Hist *hist = scratch(OP_KINDS * sizeof(Hist));
+    for (int i = 0; i < 2 * THREADS; i++) {
+        ops += workers[i].ops;
+        failed += workers[i].failed;
+        for (int k = 0; k < OP_KINDS; k++) hist_merge(&hist[k], &workers[i].hist[k]);
+    }
+    double grown = (double)(hwm > base ? hwm - base : 1) * 1024;
+    double util = 100.0 * (double)atomic_load(&peak_live) / grown;
+
+    for (int k = 0; k < OP_KINDS; k++) {
+        if (!hist[k].total) continue;
+        const char *fmt = csv ? "%s,%s,%zu,%.3f,%s,%llu,%llu,%llu,%ld,%.1f,%zu\n"
+                              : "%-6s %-12s %9zu %8.3f  %-8s %6llu %7llu %8llu %9ld %6.1f%% %6zu\n";
+        printf(fmt, ALLOCATOR_NAME, name, ops, (double)ops / secs / 1e6, op_names[k],
+               (unsigned long long)hist_percentile(&hist[k], 0.5),
+               (unsigned long long)hist_percentile(&hist[k], 0.99),
+               (unsigned long long)hist_percentile(&hist[k], 0.999), hwm, util, failed);
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief Runs a workload in a child process and waits for it.
+ * @param name The workload name.
+ * @param run The workload.
+ * @param arg The workload's argument.
+ */
+static void run_isolated(const char *name, void (*run)(const char *), const char *arg) {
+    // Flush first, or the child would print the parent's buffered output again.
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("bench: fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        measure(name, run, arg);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) fprintf(stderr, "bench: %s failed\n", name);
+}
+
+/**
+ * @brief Runs every workload and trace against the current allocator.
+ * @param traces The trace files to replay.
+ * @param count The number of traces.
+ */
+static void run_all(char **traces, int count) {
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        if (workloads[i].threaded && !BACKEND_THREAD_SAFE) continue;
+        run_isolated(workloads[i].name, workloads[i].run, NULL);
+    }
+    for (int i = 0; i < count; i++) {
+        const char *base = strrchr(traces[i], '/');
+        run_isolated(base ? base + 1 : traces[i], run_trace, traces[i]);
+    }
+}
+
+/**
+ * @brief The main entry point for the benchmark suite.
+ *
+ * Usage: bench [-c] [-n ops] [-l live] [-a backend,...] [trace ...]
+ *
+ * -a is only available with BACKEND_REGISTRY and defaults to all backends.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @return 0 on success, 2 on a usage error.
+ */
+int main(int argc, char **argv) {
+    int opt;
+#if defined(BACKEND_REGISTRY)
+    const char *names = NULL;
+    while ((opt = getopt(argc, argv, "cn:l:a:")) != -1) {
+#else
+    while ((opt = getopt(argc, argv, "cn:l:")) != -1) {
+#endif
+        switch (opt) {
+        case 'c': csv = 1; break;
+        case 'n': num_ops = strtoul(optarg, NULL, 10); break;
+        case 'l': num_live = strtoul(optarg, NULL, 10); break;
+#if defined(BACKEND_REGISTRY)
+        case 'a': names = optarg; break;
+#endif
+        default:
+            fprintf(stderr, "usage: %s [-c] [-n ops] [-l live] [-a backend,...] [trace ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (num_live < THREADS) num_live = THREADS;
+
+    if (csv) printf("allocator,workload,ops,mops,op,p50_ns,p99_ns,p999_ns,peak_rss_kb,util_pct,failed\n");
+    else printf("%-6s %-12s %9s %8s  %-8s %6s %7s %8s %9s %7s %6s\n", "alloc", "workload", "ops", "Mops/s",
+                "op", "p50ns", "p99ns", "p999ns", "peakKB", "util", "failed");
+#if defined(BACKEND_REGISTRY)
+    if (!names) {
+        for (const struct my_backend *const *b = my_backends(); *b; b++) {
+            backend = *b;
+            run_all(argv + optind, argc - optind);
+        }
+        return 0;
+    }
+    char *list = strdup(names);
+    for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        if (!(backend = my_backend_find(name))) {
+            fprintf(stderr, "bench: unknown backend %s\n", name);
+            return 2;
+        }
+        run_all(argv + optind, argc - optind);
+    }
+    free(list);
+#else
+    run_all(argv + optind, argc - optind);
+#endif
+    return 0;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file mymalloc.c
+ * @brief The registry of allocator backends.
+ *
+ * Linking this file pulls in every backend, so that a program such as the
+ * benchmark suite can run them side by side and pick them by name.
+ */
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mymalloc.h"
+
+const struct my_backend my_backend_libc = {
+    "libc", "system malloc", 1, malloc, free, calloc, realloc, malloc_stats,
+};
+
+// The backends of the registry, in the order they are listed.
+static const struct my_backend *const backends[] = {
+    &my_backend_min,
+    &my_backend_adv,
+    &my_backend_libc,
+    NULL,
+};
+
+/**
+ * @brief Returns every backend of the registry.
+ * @return A NULL-terminated array of backends.
+ */
+const struct my_backend *const *my_backends(void) {
+    return backends;
+}
+
+/**
+ * @brief Looks a backend up by name.
+ * @param name The backend's name.
+ * @return The backend, or NULL if there is none of that name.
+ */
+const struct my_backend *my_backend_find(const char *name) {
+    for (int i = 0; backends[i]; i++) {
+        if (!strcmp(backends[i]->name, name)) return backends[i];
+    }
+    return NULL;
+}
@@ -2,309 +2,4694 @@
  * @file mymalloc_adv.c
  * @brief An advanced implementation of a custom memory allocator.
  *
- * This implementation uses a segregated free list with bins for different size
- * classes to improve allocation performance. It also supports coalescing of
- * adjacent free blocks to reduce external fragmentation.
+ * This implementation uses a two-level segregated fit (TLSF) free list: the
+ * first level splits block sizes by power of two, the second level splits
+ * each power of two into SL_COUNT linear ranges, and a bitmap per level
+ * records which bins are non-empty, so a fitting bin is found with a couple
+ * of bit scans instead of a list walk. It also supports coalescing of
+ * adjacent free blocks to reduce external fragmentation. The bins of blocks
+ * of 1 KB and more also keep their blocks in a red-black tree ordered by size
+ * and address, which turns their good fit into a best fit.
+ *
+ * Small requests (up to SLAB_MAX bytes) do not use boundary-tagged blocks.
+ * They are rounded up to one of NUM_CLASSES size classes and carved from
+ * page-sized runs that hold objects of a single class with no per-object
+ * header; the run owning an object is found by masking its address. Runs
+ * themselves are ordinary blocks, so split_block and coalesce only ever see
+ * large requests and whole runs.
+ *
+ * The heap grows on demand. It is made of chunks mapped from the OS with mmap,
+ * each aligned to CHUNK_SIZE and ending in an allocated sentinel block so that
+ * coalescing never crosses from one chunk into the next. A two-level radix
+ * tree maps every CHUNK_SIZE-aligned address range to its chunk, so finding
+ * the chunk that owns a pointer is O(1).
+ *
+ * Requests of at least the mmap threshold bypass the heap entirely: each gets
+ * a private mapping that is unmapped on free and resized with mremap, so
+ * large transient buffers neither fragment the chunks nor pin memory after
+ * they are freed.
+ *
+ * Every pointer returned is aligned to ALIGN (16) bytes, as the x86-64 ABI
+ * requires for SSE types. Larger alignments come from my_aligned_alloc, which
+ * splits any leading padding off as a free block instead of wasting it.
+ *
+ * The heap is split per NUMA node: each node has its own bins, chunks bound
+ * to its memory with mbind, and a mutex. Threads allocate from the node they
+ * first ran on, and a free always returns memory to the node of the chunk it
+ * came from. Slab runs, however, are
+ * owned by the thread heap that carved or adopted them, so most small
+ * allocations and frees never touch shared state. A thread freeing another
+ * thread's object pushes it onto the owner's lock-free remote-free stack,
+ * which the owner drains when it runs out of local objects. Mid-sized
+ * blocks freed onto a fastbin, and reused from it, only take that fastbin's
+ * spinlock; the node mutex is taken when they are merged back into the bins.
+ *
+ * Built with HARDENED_ALLOCATOR, every block header carries a keyed check of
+ * its address and size, footers are checked against the headers they
+ * describe, and free list links are stored xor'ed with a key derived from
+ * their address, so heap corruption aborts instead of being followed.
+ * DEBUG_ALLOCATOR adds redzones, junk filling and a quarantine on top.
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <execinfo.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "mymalloc.h"
+#include "mymalloc_adv.h"
+#include "mymalloc_trace.h"
 
-// The total size of the heap in bytes (1 MB).
-#define HEAP_SIZE (1024*1024)
+// log2 of the chunk alignment and of the smallest chunk.
+#define CHUNK_SHIFT 21
+// The alignment and size granularity of heap chunks in bytes (2 MB).
+#define CHUNK_SIZE ((size_t)1 << CHUNK_SHIFT)
+// The largest chunk the heap grows by at once, unless one request needs more.
+#define MAX_CHUNK_SIZE (64 * CHUNK_SIZE)
+// The largest chunk: its one free block must still fit the last bin, so
+// stay a chunk below 1 << FL_MAX.
+#define MAX_HEAP_CHUNK (((size_t)1 << FL_MAX) - CHUNK_SIZE)
+// The largest request the bins serve, with room to spare in a MAX_HEAP_CHUNK
+// for the chunk header and the rounding of find_fit.
+#define MAX_BIN_REQUEST (MAX_HEAP_CHUNK / 2)
+// The default size from which requests get their own mapping (1 MB).
+#define DEFAULT_MMAP_THRESHOLD (1024 * 1024)
+// The granularity of huge mappings, and its log2.
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+// The mmap flags of chunks backed by the hugetlbfs pool's 2 MB pages, the
+// size of CHUNK_SIZE.
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+#define HUGETLB_FLAGS (MAP_HUGETLB | (CHUNK_SHIFT << MAP_HUGE_SHIFT))
+#endif
+// The most NUMA nodes that get a heap of their own.
+#define MAX_NODES 16
+// The mbind policy: allocate on the given node while it has free memory.
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+// Identifies the header of a huge mapping, mixed with its address.
+#define HUGE_MAGIC ((uintptr_t)0x4a6e6d6170a11c8dULL)
+// The number of address bits the chunk map covers.
+#define MAP_ADDR_BITS 48
+// The number of chunk map keys handled by each leaf of the radix tree.
+#define MAP_LEAF_BITS 13
+// The number of root entries of the radix tree.
+#define MAP_ROOT_BITS (MAP_ADDR_BITS - CHUNK_SHIFT - MAP_LEAF_BITS)
 // The alignment for allocated memory in bytes.
-#define ALIGN 8
-// The number of bins in the segregated free list.
-#define NUM_BINS 6
+#define ALIGN 16
+// log2 of ALIGN.
+#define ALIGN_SHIFT 4
+// log2 of the number of second-level bins per first-level class.
+#define SL_SHIFT 4
+// The number of second-level bins per first-level class.
+#define SL_COUNT (1 << SL_SHIFT)
+// Sizes below SMALL_BLOCK all live in first-level class 0, split linearly.
+#define FL_SHIFT (SL_SHIFT + ALIGN_SHIFT)
+#define SMALL_BLOCK (1 << FL_SHIFT)
+// log2 of the first size that no bin can hold.
+#define FL_MAX 32
+// The number of first-level classes.
+#define FL_COUNT (FL_MAX - FL_SHIFT + 1)
+// The most blocks find_aligned_fit inspects before settling for a larger bin.
+#define ALIGNED_PROBES 16
+// Bins of sizes from 1 << TREE_SHIFT bytes up also index their blocks in a
+// red-black tree, starting at first-level class TREE_FL.
+#define TREE_SHIFT 10
+#define TREE_FL (TREE_SHIFT - FL_SHIFT + 1)
+// Marks a red tree node in the low bit of its parent link.
+#define TREE_RED 1
+
+// log2 of the size of a slab run.
+#define RUN_SHIFT 12
+// The size and alignment of a slab run in bytes (one page).
+#define RUN_SIZE (1 << RUN_SHIFT)
+// The bytes reserved for the Run header at the start of each run.
+#define RUN_HEADER_SIZE 64
+// The number of small size classes.
+#define NUM_CLASSES 20
+// The largest request served from a slab run.
+#define SLAB_MAX 1024
+// Marks the second word of an object that sits on a free list.
+#define FREE_OBJ_KEY ((uintptr_t)0x5ab1ef4ee5ab1ef4ULL)
 
-// The static array that represents our heap, aligned to ALIGN.
-static unsigned char heap[HEAP_SIZE] __attribute__((aligned(ALIGN)));
-// A flag to indicate if the heap has been initialized.
-static int heap_initialized = 0;
+// Freed blocks of up to FAST_MAX bytes wait unmerged in fastbins, each of
+// which covers FAST_STEP bytes of sizes above SLAB_MAX.
+#define FAST_MAX 8192
+#define FAST_STEP 64
+#define FAST_BINS ((FAST_MAX - SLAB_MAX) / FAST_STEP)
+// A node's fastbins are consolidated once they hold this many bytes.
+#define FAST_LIMIT (256 * 1024)
+// The size of a cache line, which data under different locks does not share.
+#define CACHE_LINE 64
+
+// Free blocks of at least PURGE_MIN bytes carry an idle stamp, and their
+// whole pages go back to the kernel once idle for the decay time, by
+// default DEFAULT_DECAY_MS milliseconds.
+#define PURGE_MIN PAGE_SIZE
+#define DEFAULT_DECAY_MS 10000
+// The decay time is counted in DECAY_STEPS epochs; a node starts a new
+// epoch, and purges, at most once per decay time / DECAY_STEPS.
+#define DECAY_STEPS 4
+// A node checks the clock once every DECAY_TICKS frees.
+#define DECAY_TICKS 64
+
+// calloc clears dirty ranges of at least this many bytes, about the size of
+// a core's L2 cache, with non-temporal stores that bypass the caches.
+#define STREAM_CLEAR_MIN (256 * 1024)
+
+// Debug builds are hardened builds that also add redzones, junk filling and
+// a quarantine. Both are picked at compile time; see the Makefile.
+#if defined(DEBUG_ALLOCATOR) && !defined(HARDENED_ALLOCATOR)
+#define HARDENED_ALLOCATOR
+#endif
+#ifdef HARDENED_ALLOCATOR
+#define HARDENED 1
+#else
+#define HARDENED 0
+#endif
+#ifdef DEBUG_ALLOCATOR
+#define DEBUG 1
+#else
+#define DEBUG 0
+#endif
+// Hardened builds keep a check of a block's address and size in the head
+// bits from HEAD_CHECK_SHIFT up, which no payload size reaches.
+#define HEAD_CHECK_SHIFT 48
+// Debug builds allocate REDZONE bytes past every request. The last word of
+// the usable size holds the requested size, and the bytes between are
+// filled with REDZONE_BYTE, so an overflow is caught when the memory is
+// freed.
+#define REDZONE 16
+#define REDZONE_BYTE 0xfd
+// Debug builds fill new allocations with ALLOC_BYTE and freed ones with
+// FREE_BYTE, and hold the last QUARANTINE_SLOTS freed allocations back
+// from reuse.
+#define ALLOC_BYTE 0xbe
+#define FREE_BYTE 0xdf
+#define QUARANTINE_SLOTS 256
+
+// The smallest and the largest capacity an arena grows by, in bytes.
+#define ARENA_MIN_CHUNK 4096
+#define ARENA_MAX_CHUNK (256 * 1024)
+
+// The deepest allocation stack the heap profiler records.
+#define PROFILE_DEPTH 32
+// The number of distinct allocation stacks the heap profiler can hold.
+#define PROFILE_BUCKETS 4096
+// The number of sampled allocations that can be live at the same time.
+#define PROFILE_SLOTS 65536
+// Marks a profile slot whose allocation has been freed.
+#define PROFILE_TOMBSTONE ((uintptr_t)1)
+// The number of records a thread's trace ring holds; a full ring is written
+// out by the thread that fills it.
+#define TRACE_RING 4096
+
+// Flags kept in the low bits of a block's head word. Payload sizes are
+// multiples of ALIGN, so these bits are otherwise always zero.
+#define BLOCK_FREE   1   ///< The block is in a bin, eligible for coalescing.
+#define PREV_FREE    2   ///< The previous block is free and prev_size is its footer.
+#define BLOCK_PURGED 4   ///< The free block's whole pages were never touched or were purged, so read as zero.
+#define BLOCK_FAST   8   ///< The block waits unmerged in a fastbin; to the bins it looks allocated.
+#define BLOCK_FLAGS  (BLOCK_FREE | PREV_FREE | BLOCK_PURGED | BLOCK_FAST)
+// The bits of a head word that hold the payload size.
+#define BLOCK_SIZE_MASK ((((size_t)1 << HEAD_CHECK_SHIFT) - 1) & ~(size_t)BLOCK_FLAGS)
 
 /**
  * @brief Represents a block of memory in the heap.
  *
- * Each block has a header with metadata, including its size, free status,
- * and pointers for both the physical list of all blocks and the free list.
+ * Blocks are laid out back to back, so the next block is found from the
+ * size. Only a free block writes a footer, and it lives in the prev_size word
+ * of the next block's header; the PREV_FREE bit of that block says whether
+ * the word is valid, which is all coalescing needs to find the previous
+ * block. The free list links are only present in free blocks and occupy the
+ * start of their payload.
  */
 typedef struct Block {
-    size_t size;                 ///< The size of the payload area in bytes.
-    int free;                    ///< 1 if the block is free, 0 if it is in use.
-    struct Block *prev_phys;     ///< A pointer to the previous physical block in the heap.
-    struct Block *next_phys;     ///< A pointer to the next physical block in the heap.
-    struct Block *prev_free;     ///< A pointer to the previous block in the free list.
-    struct Block *next_free;     ///< A pointer to the next block in the free list.
+    size_t prev_size;            ///< The previous block's payload size, if PREV_FREE is set.
+    size_t head;                 ///< The payload size in bytes, or'ed with BLOCK_FLAGS and the head check.
+    struct Block *prev_free;     ///< The previous block in the free list (free blocks only).
+    struct Block *next_free;     ///< The next block in the free list (free blocks only).
 } Block;
 
-// An array of pointers to the first block in each bin of the segregated free list.
-static Block *bin[NUM_BINS];
-// A pointer to the first block in the heap.
-static Block *heap_start = NULL;
+// The size of a block header; the payload starts right after it.
+#define BLOCK_HEADER offsetof(Block, prev_free)
+// The space a block takes on top of its payload.
+#define BLOCK_OVERHEAD BLOCK_HEADER
+
+// The payload size of the block backing a run. The next block's header fills
+// the rest of the page, so runs carved back to back stay RUN_SIZE-aligned
+// without padding between them.
+#define RUN_PAYLOAD (RUN_SIZE - BLOCK_OVERHEAD)
+
+/**
+ * @brief The header at the start of a slab run.
+ *
+ * A run is the RUN_SIZE-aligned payload of a block. Its objects start at
+ * RUN_HEADER_SIZE and all belong to one size class. A run either belongs to
+ * one thread heap or is an orphan on the partial list of its class in its
+ * node, under the node's lock.
+ */
+typedef struct Run {
+    struct Run *prev;            ///< The previous run in its owner's or the orphan list.
+    struct Run *next;            ///< The next run in its owner's or the orphan list.
+    void *free_list;             ///< Free objects, chained through their first word.
+    _Atomic(struct ThreadHeap*) owner; ///< The heap that owns the run, or NULL for an orphan.
+    unsigned short class_idx;    ///< The size class of the run's objects.
+    unsigned short nfree;        ///< The number of objects on free_list.
+    unsigned short nobjs;        ///< The number of objects the run holds.
+} Run;
+
+_Static_assert(sizeof(Run) <= RUN_HEADER_SIZE, "Run header does not fit");
+_Static_assert(BLOCK_HEADER % ALIGN == 0, "Block header breaks payload alignment");
+_Static_assert(sizeof(Block) - BLOCK_HEADER <= ALIGN, "Free list links do not fit in the smallest block");
+
+/**
+ * @brief The red-black tree links of a free block in a tree bin.
+ *
+ * They follow the idle stamp in the payload, which every block of a tree
+ * bin is large enough for. Blocks are ordered by size, then by address, so
+ * the tree yields the best fit at the lowest address.
+ */
+typedef struct TreeLinks {
+    Block *child[2];    ///< The left and right subtrees.
+    uintptr_t parent;   ///< The parent block, or'ed with TREE_RED.
+} TreeLinks;
+
+/**
+ * @brief The header at the start of every heap chunk.
+ *
+ * The header is followed by the chunk's run map, then by its first block.
+ * The last BLOCK_HEADER bytes of the chunk hold its sentinel.
+ */
+typedef struct Chunk {
+    struct Chunk *next;          ///< The next chunk of its node, in the order they were mapped.
+    struct Node *node;           ///< The node whose bins the chunk's free blocks go to.
+    size_t size;                 ///< The size of the mapping in bytes.
+    Block *first;                ///< The first block of the chunk.
+    Block *sentinel;             ///< The allocated, empty block that ends the chunk.
+    unsigned char run_map[];     ///< 1 for every page that starts a slab run.
+} Chunk;
+
+/**
+ * @brief The header at the start of a huge allocation's private mapping.
+ *
+ * The user pointer either directly follows the header or, for aligned
+ * allocations, sits one page after it. Either way the header is at a page
+ * boundary, which is what my_free checks before trusting the magic.
+ */
+typedef struct Huge {
+    size_t map_size;             ///< The size of the mapping in bytes.
+    uintptr_t magic;             ///< HUGE_MAGIC xor the header's address.
+} Huge;
+
+/**
+ * @brief The sampled allocations of one allocation stack.
+ */
+typedef struct ProfileBucket {
+    uint64_t hash;                   ///< The hash of the stack; 0 for an unused bucket.
+    int depth;                       ///< The number of frames in stack.
+    void *stack[PROFILE_DEPTH];      ///< The return addresses, innermost first.
+    size_t live_objs, live_bytes;    ///< Sampled allocations not yet freed.
+    size_t total_objs, total_bytes;  ///< All sampled allocations.
+} ProfileBucket;
+
+/**
+ * @brief A live sampled allocation.
+ *
+ * Slots form an open-addressed table keyed by the user pointer. Keys are
+ * read without the profile lock, so my_free can check a pointer cheaply.
+ */
+typedef struct ProfileSlot {
+    _Atomic uintptr_t key;       ///< The user pointer, 0 if never used, or PROFILE_TOMBSTONE.
+    uint32_t bucket;             ///< The index of the allocation's ProfileBucket.
+    size_t size;                 ///< The requested size.
+} ProfileSlot;
+
+/**
+ * @brief The records a thread has traced but not yet written out.
+ *
+ * Only the owning thread adds records, without a lock. Whoever writes them
+ * out, the owner when the ring is full or my_trace_stop, holds busy. Rings
+ * are never unmapped; a thread that exits gives its ring up for the next
+ * thread to trace.
+ */
+typedef struct TraceRing {
+    struct my_trace_record rec[TRACE_RING]; ///< The records, indexed by count % TRACE_RING.
+    _Atomic size_t head;         ///< The number of records added.
+    _Atomic size_t tail;         ///< The number of records written out.
+    atomic_flag busy;            ///< Held while records are written out.
+    _Atomic int owned;           ///< Non-zero while a thread adds to the ring.
+    uint32_t thread;             ///< The trace's number for the owning thread.
+    struct TraceRing *next;      ///< The next ring ever created.
+} TraceRing;
+
+/**
+ * @brief The layout of a small object while it sits on a free list.
+ */
+typedef struct FreeObj {
+    struct FreeObj *next;        ///< The next free object.
+    uintptr_t key;               ///< FREE_OBJ_KEY, used to catch double frees.
+} FreeObj;
+
+/**
+ * @brief The header of a block of memory backing an arena.
+ *
+ * Arena chunks are ordinary my_malloc blocks; the bump region follows the
+ * header directly.
+ */
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;     ///< The next chunk of the arena. The first one is bumped.
+    size_t size;                 ///< The capacity of the chunk in bytes.
+} ArenaChunk;
+
+/**
+ * @brief A region of memory whose allocations are all released together.
+ */
+struct my_arena {
+    ArenaChunk *chunks;          ///< The arena's chunks, the one being bumped first.
+    char *ptr;                   ///< The next free byte of the first chunk.
+    char *end;                   ///< The end of the first chunk.
+    size_t next_size;            ///< The capacity of the next chunk.
+};
+
+_Static_assert(sizeof(ArenaChunk) % ALIGN == 0, "ArenaChunk header breaks payload alignment");
+
+/**
+ * @brief The recently freed blocks of one FAST_STEP range of sizes.
+ *
+ * Each fastbin has a lock and a cache line of its own, so that threads
+ * freeing and reusing mid-sized blocks of different sizes neither wait for
+ * the node lock nor for each other. Its blocks are chained through
+ * next_free and carry BLOCK_FAST in their head word; to the rest of the
+ * node they look allocated.
+ */
+typedef struct FastBin {
+    _Alignas(CACHE_LINE) pthread_spinlock_t lock; ///< Protects the list.
+    _Atomic(Block*) first;               ///< The most recently freed block, read unlocked to skip empty bins.
+} FastBin;
+
+/**
+ * @brief The part of the heap that lives on one NUMA node.
+ *
+ * Every chunk is bound to the memory of its node, and its free blocks and
+ * orphan runs only ever go back to that node's bins and lists, whichever
+ * thread frees them.
+ */
+typedef struct Node {
+    pthread_mutex_t lock;                ///< Protects everything below but the fastbins.
+    Block *bin[FL_COUNT][SL_COUNT];      ///< The first free block in each bin.
+    Block *tree[FL_COUNT][SL_COUNT];     ///< The tree root of each bin from TREE_FL on.
+    uint32_t fl_bitmap;                  ///< Bit fl is set when some bin of class fl is non-empty.
+    uint32_t sl_bitmap[FL_COUNT];        ///< Bit sl of sl_bitmap[fl] is set when bin[fl][sl] is non-empty.
+    Chunk *first_chunk;                  ///< The node's first chunk.
+    Chunk *last_chunk;                   ///< The node's last chunk.
+    size_t next_chunk_size;              ///< The size of the next chunk; doubles up to MAX_CHUNK_SIZE.
+    struct Run *partial[NUM_CLASSES];    ///< The orphan runs of each class with free objects.
+    FastBin fast[FAST_BINS];             ///< Recently freed blocks, unmerged, each bin under its own lock.
+    _Atomic size_t fast_bytes;           ///< The payload bytes waiting in fast.
+    size_t epoch;                        ///< The decay epoch, which stamps blocks entering the bins.
+    uint64_t epoch_ms;                   ///< When the current epoch began.
+    unsigned ticks;                      ///< Frees since the clock was last checked.
+    struct ThreadHeap *heap_pool;        ///< Heaps of exited threads that ran on this node.
+    struct my_heap *heap;                ///< The my_heap_t the node backs, or NULL for a NUMA node.
+    int id;                              ///< The NUMA node number.
+} Node;
+
+/**
+ * @brief An independent heap, whose node sits outside the NUMA nodes.
+ *
+ * Its chunks are its own, so destroying it unmaps them without looking at
+ * the blocks inside, and it counts its bytes apart from the thread
+ * statistics.
+ */
+struct my_heap {
+    Node node;                           ///< The bins and chunks of the heap.
+    _Atomic size_t allocated;            ///< The payload bytes allocated and not yet freed.
+    struct my_heap *prev;                ///< The previous live heap.
+    struct my_heap *next;                ///< The next live heap.
+};
+
+// The heap of each NUMA node. Nodes past MAX_NODES share the first one.
+static Node nodes[MAX_NODES];
+// The number of NUMA nodes the system can have, at most MAX_NODES.
+static int num_nodes = 1;
+// Guards the one-time set up of nodes.
+static pthread_once_t nodes_once = PTHREAD_ONCE_INIT;
+// The node of the calling thread, picked on its first allocation.
+static _Thread_local Node *tnode;
+// The heaps created by my_heap_create and not yet destroyed.
+static my_heap_t *live_heaps;
+// Protects live_heaps. Only node and map locks are taken while it is held.
+static pthread_mutex_t heaps_lock = PTHREAD_MUTEX_INITIALIZER;
+// The radix tree from address >> CHUNK_SHIFT to the chunk that covers it.
+// Leaves are created on demand and never freed, so lookups need no lock.
+static Chunk **chunk_map[(size_t)1 << MAP_ROOT_BITS];
+// Serializes updates of chunk_map by different nodes.
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+// The headers of the live huge mappings, an open-addressed set of
+// huge_slots entries that doubles once half full. A pointer outside the
+// chunks is only read as a huge allocation once its header is found here.
+static Huge **huge_set;
+static size_t huge_slots;
+static size_t huge_count;
+// Protects the huge set. Never held while taking another lock.
+static pthread_mutex_t huge_lock = PTHREAD_MUTEX_INITIALIZER;
+// Requests of at least this many bytes are served by mmap directly.
+static _Atomic size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+// How long a free block stays idle before its pages are purged, in
+// milliseconds; SIZE_MAX disables purging.
+static _Atomic size_t decay_ms = DEFAULT_DECAY_MS;
+// Whether new heap chunks are pre-faulted, and the pages that back them;
+// see MY_M_POPULATE and MY_M_HUGEPAGES.
+static _Atomic int map_populate;
+static _Atomic int map_hugepages;
+// The random key of the head checks and free list links of hardened builds,
+// set once with the nodes. Its low bits are all set, so that a link
+// overwritten with an aligned pointer no longer decodes to one.
+static uintptr_t heap_secret;
+// The allocations debug builds have freed but not yet released, oldest at
+// quarantine_next.
+static void *quarantine[QUARANTINE_SLOTS];
+static size_t quarantine_next;
+// Protects the quarantine. Never held while taking another lock.
+static pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER;
+// The mean number of bytes between heap profile samples, 0 when off.
+static _Atomic size_t profile_rate;
+// The last non-zero profile rate, which the dump reports.
+static size_t profile_last_rate;
+// The number of sampled allocations that are still live.
+static _Atomic size_t profile_live;
+// The heap profile tables, mapped the first time sampling is enabled.
+static ProfileBucket *profile_buckets;
+static ProfileSlot *profile_slots;
+// Protects the heap profile tables, except for lookups of slot keys.
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+// The bytes the calling thread still allocates before its next sample.
+static _Thread_local size_t sample_left;
+// The calling thread's random state for sample intervals.
+static _Thread_local uint64_t sample_rng;
+// Set while the calling thread records a sample, so that allocations made
+// by backtrace itself are not sampled.
+static _Thread_local int in_sample;
+// Whether allocations are being traced.
+static _Atomic int trace_on;
+// The file the trace is written to, or -1.
+static _Atomic int trace_fd = -1;
+// When the trace started, in nanoseconds of the monotonic clock.
+static _Atomic uint64_t trace_epoch;
+// Every trace ring ever created, newest first.
+static _Atomic(TraceRing*) trace_rings;
+// The number the next thread to take a trace ring is given.
+static _Atomic uint32_t trace_threads;
+// The calling thread's trace ring.
+static _Thread_local TraceRing *tring;
+// Set while my_realloc runs, so that the allocations it makes itself are
+// not traced apart from it.
+static _Thread_local int in_realloc;
+// The key whose destructor gives up a thread's trace ring when it exits.
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+
+// The object size of each small size class.
+static const unsigned short class_size[NUM_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024
+};
+// Indexes of the per-bin event counters.
+enum { STAT_MALLOC, STAT_FREE, STAT_SPLIT, STAT_COALESCE, STAT_BIN_EVENTS };
+
+/**
+ * @brief Allocation counters of one thread.
+ *
+ * Only the owning thread writes a ThreadStats, with plain relaxed loads and
+ * stores, so counting costs no atomic read-modify-write; my_malloc_stats
+ * reads them from other threads and sums them. The shared fallback used
+ * before a thread has a heap is the exception and is updated atomically.
+ */
+typedef struct ThreadStats {
+    _Atomic size_t alloc_bytes;                       ///< Usable bytes handed out.
+    _Atomic size_t free_bytes;                        ///< Usable bytes freed.
+    _Atomic size_t bin[FL_COUNT][STAT_BIN_EVENTS];    ///< Block events by first-level bin.
+    _Atomic size_t class_malloc[NUM_CLASSES];         ///< Small objects handed out by class.
+    _Atomic size_t class_free[NUM_CLASSES];           ///< Small objects freed by class.
+    _Atomic size_t probes[MY_STATS_PROBE_BUCKETS];    ///< Bin search probe-length histogram.
+} ThreadStats;
+
+_Static_assert(FL_COUNT == MY_STATS_BINS, "MY_STATS_BINS is out of date");
+_Static_assert(NUM_CLASSES == MY_STATS_CLASSES, "MY_STATS_CLASSES is out of date");
+
+/**
+ * @brief A thread's private set of slab runs.
+ *
+ * Only the owning thread touches runs[] and the free lists of the runs on it,
+ * so neither needs a lock. Other threads give objects back through remote, a
+ * lock-free stack that the owner drains when a class runs dry. Heaps are
+ * never freed: when a thread exits its heap waits in its node's heap_pool
+ * for the next new thread, so a late remote free always lands on live memory.
+ *
+ * A heap covers whole cache lines, and remote has one to itself, so that
+ * neither the heaps of neighbouring threads nor the frees other threads
+ * push invalidate the lines the owner writes on every allocation.
+ */
+typedef struct ThreadHeap {
+    Run *runs[NUM_CLASSES];        ///< The owned runs of each class with local free objects.
+    Node *node;                    ///< The node the heap's runs are carved from.
+    struct ThreadHeap *next;       ///< The next heap in the node's heap_pool.
+    struct ThreadHeap *next_all;   ///< The next heap ever created, for my_malloc_stats.
+    _Alignas(CACHE_LINE) _Atomic(FreeObj*) remote; ///< Objects freed by other threads, chained through next.
+    _Alignas(CACHE_LINE) ThreadStats stats;        ///< The counters of the thread using the heap.
+} ThreadHeap;
+
+// The calling thread's heap, or NULL before its first small allocation.
+static _Thread_local ThreadHeap *theap;
+// Every thread heap ever created, newest first. Protected by stats_lock.
+static ThreadHeap *all_heaps;
+// Protects all_heaps. Never held while taking another lock.
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+// Counters of threads that have no heap, updated atomically.
+static ThreadStats shared_stats;
+// The bytes currently mapped for heap chunks and huge allocations, and the peak.
+static _Atomic size_t mapped_bytes;
+static _Atomic size_t peak_mapped_bytes;
+// The key whose destructor abandons a thread's heap when the thread exits.
+static pthread_key_t theap_key;
+// Guards the one-time creation of theap_key.
+static pthread_once_t theap_key_once = PTHREAD_ONCE_INIT;
 
 /**
  * @brief Aligns a size to the next multiple of ALIGN.
  * @param n The size to align.
  * @return The aligned size.
  */
-static size_t align8(size_t n) { return (n + 7) & ~7; }
+static size_t align_up(size_t n) { return (n + ALIGN - 1) & ~(size_t)(ALIGN - 1); }
 
 /**
- * @brief Writes the size of a block to its footer.
- * @param b A pointer to the block.
+ * @brief Returns the counters the calling thread should update.
+ * @return The thread heap's counters, or the shared ones if there is no heap.
  */
-static void write_footer(Block *b) {
-    *((size_t*)((char*)b + sizeof(Block) + b->size)) = b->size;
+static ThreadStats *cur_stats(void) {
+    return theap ? &theap->stats : &shared_stats;
 }
 
 /**
- * @brief Reads the size of a block from its footer.
- * @param b A pointer to the block.
- * @return The size of the block.
+ * @brief Adds to a counter of the calling thread.
+ * @param ts The counters returned by cur_stats.
+ * @param c The counter.
+ * @param n The amount to add.
  */
-static size_t read_footer(Block *b) {
-    return *((size_t*)((char*)b + sizeof(Block) + b->size));
+static void stat_add(ThreadStats *ts, _Atomic size_t *c, size_t n) {
+    if (ts == &shared_stats) atomic_fetch_add_explicit(c, n, memory_order_relaxed);
+    else atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
 }
 
 /**
- * @brief Determines the bin index for a given size.
- * @param size The size of the block.
- * @return The index of the bin for the given size.
+ * @brief Records the number of bins or blocks a search looked at.
+ * @param n The probe count, at least 1.
  */
-static int size_to_bin(size_t size) {
-    if (size <= 64) return 0;
-    if (size <= 128) return 1;
-    if (size <= 256) return 2;
-    if (size <= 512) return 3;
-    if (size <= 1024) return 4;
-    return 5;
+static void stat_probes(int n) {
+    int bucket = 31 - __builtin_clz((unsigned)n);
+    if (bucket >= MY_STATS_PROBE_BUCKETS) bucket = MY_STATS_PROBE_BUCKETS - 1;
+    ThreadStats *ts = cur_stats();
+    stat_add(ts, &ts->probes[bucket], 1);
 }
 
 /**
- * @brief Inserts a block into the appropriate free list.
- * @param b A pointer to the block to insert.
+ * @brief Counts bytes handed out to or returned by the user.
+ * @param alloc The usable bytes allocated.
+ * @param freed The usable bytes freed.
  */
-static void insert_free(Block *b) {
-    int idx = size_to_bin(b->size);
-    b->prev_free = NULL;
-    b->next_free = bin[idx];
-    if (bin[idx]) bin[idx]->prev_free = b;
-    bin[idx] = b;
+static void stat_bytes(size_t alloc, size_t freed) {
+    ThreadStats *ts = cur_stats();
+    if (alloc) stat_add(ts, &ts->alloc_bytes, alloc);
+    if (freed) stat_add(ts, &ts->free_bytes, freed);
 }
 
 /**
- * @brief Removes a block from its free list.
- * @param b A pointer to the block to remove.
+ * @brief Counts bytes of a node's blocks handed out to or returned by the user.
+ *
+ * A my_heap_t keeps its own count; the NUMA nodes count per thread.
+ *
+ * @param nd The node the block belongs to.
+ * @param alloc The usable bytes allocated.
+ * @param freed The usable bytes freed.
+ */
+static void node_bytes(Node *nd, size_t alloc, size_t freed) {
+    if (!nd->heap) {
+        stat_bytes(alloc, freed);
+    } else if (alloc) {
+        atomic_fetch_add_explicit(&nd->heap->allocated, alloc, memory_order_relaxed);
+    } else {
+        atomic_fetch_sub_explicit(&nd->heap->allocated, freed, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Counts a small object handed out or returned in a size class.
+ * @param c The size class.
+ * @param freed 1 if the object was freed, 0 if it was allocated.
+ */
+static void stat_class(int c, int freed) {
+    ThreadStats *ts = cur_stats();
+    if (freed) {
+        stat_add(ts, &ts->class_free[c], 1);
+        stat_add(ts, &ts->free_bytes, class_size[c]);
+    } else {
+        stat_add(ts, &ts->class_malloc[c], 1);
+        stat_add(ts, &ts->alloc_bytes, class_size[c]);
+    }
+}
+
+/**
+ * @brief Tracks memory mapped from or returned to the OS.
+ * @param add The bytes mapped.
+ * @param sub The bytes unmapped.
  */
-static void remove_free(Block *b) {
-    int idx = size_to_bin(b->size);
-    if (b->prev_free) b->prev_free->next_free = b->next_free;
-    else bin[idx] = b->next_free;
-    if (b->next_free) b->next_free->prev_free = b->prev_free;
-    b->prev_free = b->next_free = NULL;
+static void stat_mapped(size_t add, size_t sub) {
+    size_t now = atomic_fetch_add_explicit(&mapped_bytes, add - sub, memory_order_relaxed) + add - sub;
+    size_t peak = atomic_load_explicit(&peak_mapped_bytes, memory_order_relaxed);
+    while (now > peak && !atomic_compare_exchange_weak_explicit(&peak_mapped_bytes, &peak, now,
+                                                                memory_order_relaxed, memory_order_relaxed)) {
+    }
 }
 
 /**
- * @brief Initializes the heap.
+ * @brief Returns the payload size of a block.
+ * @param b A pointer to the block.
+ * @return The size of the block's payload in bytes.
+ */
+static size_t block_size(const Block *b) { return b->head & BLOCK_SIZE_MASK; }
+
+/**
+ * @brief Checks whether a block is free.
+ * @param b A pointer to the block.
+ * @return Non-zero if the block is free.
+ */
+static int block_is_free(const Block *b) { return (int)(b->head & BLOCK_FREE); }
+
+/**
+ * @brief Reads the head word of a block that the node lock may not cover.
+ *
+ * The allocated block's owner reads it to free the block onto a fastbin
+ * while the node lock's holder may be setting its PREV_FREE bit. As the
+ * owner also sets and clears BLOCK_FAST, write_footer and mark_used update
+ * the bit with atomic read-modify-writes so that neither loses the other's.
+ *
+ * @param b A pointer to the block.
+ * @return The head word.
+ */
+static size_t load_head(const Block *b) { return __atomic_load_n(&b->head, __ATOMIC_RELAXED); }
+
+/**
+ * @brief Reports a corrupted heap and aborts.
  *
- * This function is called once when the allocator is first used. It sets up
- * a single large free block that covers the entire heap and initializes the
- * free list bins.
+ * Hardened builds call this where carrying on would follow a damaged
+ * pointer or trust a damaged size.
+ *
+ * @param what What was found damaged.
+ * @param ptr Where.
  */
-static void heap_init() {
-    heap_start = (Block*)heap;
-    heap_start->size = HEAP_SIZE - sizeof(Block) - sizeof(size_t);
-    heap_start->free = 1;
-    heap_start->prev_phys = heap_start->next_phys = NULL;
-    write_footer(heap_start);
-    for (int i=0;i<NUM_BINS;i++) bin[i] = NULL;
-    insert_free(heap_start);
-    heap_initialized = 1;
+static __attribute__((noreturn, cold)) void corrupt(const char *what, const void *ptr) {
+    fprintf(stderr, "my_malloc: %s at %p\n", what, ptr);
+    abort();
 }
 
 /**
- * @brief Finds a suitable free block for a given size.
+ * @brief Computes the head check of a block.
+ * @param b A pointer to the block.
+ * @param size The block's payload size.
+ * @return The check bits to or into the head word, 0 unless hardened.
+ */
+static size_t head_check(const Block *b, size_t size) {
+    if (!HARDENED) return 0;
+    uint64_t h = ((uint64_t)(uintptr_t)b ^ size ^ heap_secret) * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h >> HEAD_CHECK_SHIFT << HEAD_CHECK_SHIFT);
+}
+
+/**
+ * @brief Writes the head word of a block.
+ * @param b A pointer to the block.
+ * @param size The payload size.
+ * @param flags The BLOCK_FLAGS bits to set.
+ */
+static void set_head(Block *b, size_t size, size_t flags) {
+    b->head = size | flags | head_check(b, size);
+}
+
+/**
+ * @brief Aborts in hardened builds if a block's head word was overwritten.
  *
- * This function searches the segregated free list for a block that is large
- * enough to hold the requested size. It starts with the appropriate bin for
- * the size and continues to larger bins if no suitable block is found.
+ * Flag updates leave the check intact, so only a write that did not go
+ * through set_head, such as a neighbor's overflow, fails it.
  *
- * @param size The required size of the payload.
- * @return A pointer to a suitable free block, or NULL if none is found.
+ * @param b A pointer to the block.
  */
-static Block* find_fit(size_t size) {
-    int idx = size_to_bin(size);
-    for (int i = idx; i < NUM_BINS; i++) {
-        Block *b = bin[i];
-        while (b) {
-            if (b->size >= size) return b;
-            b = b->next_free;
-        }
+static void check_block(const Block *b) {
+    size_t head = load_head(b);
+    if (HARDENED && (head & ~(size_t)0 << HEAD_CHECK_SHIFT) != head_check(b, head & BLOCK_SIZE_MASK)) {
+        corrupt("corrupted block header", b);
     }
-    return NULL;
 }
 
 /**
- * @brief Splits a block into two if it is large enough.
+ * @brief Returns the key a free list link is stored xor'ed with.
  *
- * If a block is larger than the required size, this function splits it into
- * an allocated block of the required size and a new free block with the
- * remaining space. The new free block is then inserted into the free list.
+ * Hardened builds mix the address of the link into the heap secret, as
+ * glibc's safe-linking does, so a link cannot be forged without knowing
+ * both, and a forged one decodes to a misaligned pointer.
  *
- * @param b The block to split.
- * @param size The required size of the payload for the new allocated block.
+ * @param slot The address the link is stored at.
+ * @return The key, 0 unless hardened.
  */
-static void split_block(Block *b, size_t size) {
-    size_t remaining = b->size - size;
-    if (remaining < sizeof(Block) + sizeof(size_t) + ALIGN) return;
-
-    // Create a new block for the remaining space.
-    Block *newb = (Block*)((char*)b + sizeof(Block) + size + sizeof(size_t));
-    newb->size = remaining - sizeof(Block) - sizeof(size_t);
-    newb->free = 1;
-    newb->prev_phys = b;
-    newb->next_phys = b->next_phys;
-    if (b->next_phys) b->next_phys->prev_phys = newb;
-
-    // Update the original block.
-    b->next_phys = newb;
-    b->size = size;
-    write_footer(b);
-    write_footer(newb);
+static uintptr_t link_key(const void *slot) {
+    return HARDENED ? ((uintptr_t)slot >> PAGE_SHIFT << ALIGN_SHIFT) ^ heap_secret : 0;
+}
 
-    // Insert the new free block into the free list.
-    insert_free(newb);
+/**
+ * @brief Decodes a free list link.
+ * @param slot The address of the link.
+ * @param v The stored value.
+ * @return The address it links to.
+ */
+static uintptr_t link_decode(const void *slot, uintptr_t v) {
+    v ^= link_key(slot);
+    if (HARDENED && (v & (ALIGN - 1))) corrupt("corrupted free list link", slot);
+    return v;
 }
 
 /**
- * @brief Allocates a block of memory of a given size.
- * @param size The number of bytes to allocate.
- * @return A pointer to the allocated memory, or NULL if the allocation fails.
+ * @brief Reads a free list link of a block.
+ * @param slot The prev_free or next_free field of a free block.
+ * @return The block it links to, or NULL.
  */
-void *my_malloc(size_t size) {
-    if (!heap_initialized) heap_init();
-    size = align8(size);
+static Block *load_link(Block *const *slot) {
+    return (Block*)link_decode(slot, (uintptr_t)*slot);
+}
 
-    // Find a suitable free block.
-    Block *b = find_fit(size);
-    if (!b) return NULL; // Out of memory.
+/**
+ * @brief Writes a free list link of a block.
+ * @param slot The prev_free or next_free field of a free block.
+ * @param p The block to link to, or NULL.
+ */
+static void store_link(Block **slot, Block *p) {
+    *slot = (Block*)((uintptr_t)p ^ link_key(slot));
+}
 
-    // Remove the block from the free list.
-    remove_free(b);
-    // Split the block if it is large enough.
-    split_block(b, size);
-    b->free = 0;
+/**
+ * @brief Reads the link of a small object on a free list or remote stack.
+ * @param o The object.
+ * @return The next object, or NULL.
+ */
+static FreeObj *obj_next(const FreeObj *o) {
+    return (FreeObj*)link_decode(&o->next, (uintptr_t)o->next);
+}
+
+/**
+ * @brief Writes the link of a small object on a free list or remote stack.
+ * @param o The object.
+ * @param next The next object, or NULL.
+ */
+static void set_obj_next(FreeObj *o, FreeObj *next) {
+    o->next = (FreeObj*)((uintptr_t)next ^ link_key(&o->next));
+}
+
+/**
+ * @brief Returns the block physically following a block.
+ * @param b A pointer to the block; must not be a chunk sentinel.
+ * @return The next block.
+ */
+static Block *next_block(const Block *b) {
+    return (Block*)((char*)b + BLOCK_OVERHEAD + block_size(b));
+}
+
+/**
+ * @brief Returns the block physically preceding a block.
+ * @param b A pointer to a block whose PREV_FREE bit is set.
+ * @return The previous block, found through its footer.
+ */
+static Block *prev_block(const Block *b) {
+    return (Block*)((char*)b - BLOCK_OVERHEAD - b->prev_size);
+}
+
+/**
+ * @brief Writes the size of a free block to its footer.
+ *
+ * The footer is the prev_size word of the next block, which is also flagged
+ * PREV_FREE. The next block may be allocated, so its head is stored as
+ * load_head expects.
+ *
+ * @param b A pointer to the block.
+ */
+static void write_footer(Block *b) {
+    Block *next = next_block(b);
+    next->prev_size = block_size(b);
+    __atomic_fetch_or(&next->head, (size_t)PREV_FREE, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Marks a block free and writes its footer.
+ * @param b A pointer to the block.
+ * @param size The block's payload size.
+ */
+static void mark_free(Block *b, size_t size) {
+    set_head(b, size, BLOCK_FREE | (b->head & PREV_FREE));
     write_footer(b);
+}
 
-    // Return a pointer to the payload.
-    return (char*)b + sizeof(Block);
+/**
+ * @brief Marks a block allocated and tells its successor.
+ * @param b A pointer to the block.
+ * @param size The block's payload size.
+ */
+static void mark_used(Block *b, size_t size) {
+    set_head(b, size, b->head & PREV_FREE);
+    Block *next = next_block(b);
+    __atomic_fetch_and(&next->head, ~(size_t)PREV_FREE, __ATOMIC_RELAXED);
 }
 
 /**
- * @brief Merges a free block with its adjacent free neighbors.
- * @param b A pointer to the block to coalesce.
+ * @brief Returns the index of the most significant set bit.
+ * @param x A non-zero value.
+ * @return floor(log2(x)).
  */
-static void coalesce(Block *b) {
-    // Merge with the next block if it is free.
-    if (b->next_phys && b->next_phys->free) {
-        remove_free(b->next_phys);
-        b->size += sizeof(Block) + sizeof(size_t) + b->next_phys->size;
-        b->next_phys = b->next_phys->next_phys;
-        if (b->next_phys) b->next_phys->prev_phys = b;
-        write_footer(b);
-    }
+static int fls_size(size_t x) {
+    return 63 - __builtin_clzll((unsigned long long)x);
+}
 
-    // Merge with the previous block if it is free.
-    if (b->prev_phys && b->prev_phys->free) {
-        remove_free(b->prev_phys);
-        b->prev_phys->size += sizeof(Block) + sizeof(size_t) + b->size;
-        b->prev_phys->next_phys = b->next_phys;
-        if (b->next_phys) b->next_phys->prev_phys = b->prev_phys;
-        write_footer(b->prev_phys);
-        b = b->prev_phys;
+/**
+ * @brief Determines the bin that holds blocks of a given size.
+ * @param size The size of the block.
+ * @param fl Receives the first-level index.
+ * @param sl Receives the second-level index.
+ */
+static void size_to_bin(size_t size, int *fl, int *sl) {
+    if (size < SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (int)(size >> ALIGN_SHIFT);
+    } else {
+        int lg = fls_size(size);
+        *fl = lg - FL_SHIFT + 1;
+        *sl = (int)(size >> (lg - SL_SHIFT)) ^ SL_COUNT;
     }
+}
 
-    // Insert the coalesced block into the free list.
-    insert_free(b);
+/**
+ * @brief Counts a block event against the bin of a size.
+ * @param event One of STAT_MALLOC, STAT_FREE, STAT_SPLIT or STAT_COALESCE.
+ * @param size The block size the event concerns.
+ */
+static void stat_bin(int event, size_t size) {
+    int fl, sl;
+    size_to_bin(size, &fl, &sl);
+    if (fl >= FL_COUNT) fl = FL_COUNT - 1;
+    ThreadStats *ts = cur_stats();
+    stat_add(ts, &ts->bin[fl][event], 1);
 }
 
 /**
- * @brief Frees a previously allocated block of memory.
- * @param ptr A pointer to the memory to free.
+ * @brief Rounds a size up to the next bin boundary.
+ *
+ * A free block of at least the returned size always sits in a bin that
+ * find_fit searches for the original size.
+ *
+ * @param size The required size of the payload.
+ * @return The rounded size.
  */
-void my_free(void *ptr) {
-    if (!ptr) return;
+static size_t search_size(size_t size) {
+    if (size >= SMALL_BLOCK) size += ((size_t)1 << (fls_size(size) - SL_SHIFT)) - 1;
+    return size;
+}
 
-    // Check if the pointer is within the heap range.
-    if ((unsigned char*)ptr < heap || (unsigned char*)ptr >= heap + HEAP_SIZE) {
-        fprintf(stderr, "my_free: pointer %p is outside heap\n", ptr);
-        return;
-    }
+/**
+ * @brief Determines the first bin whose every block can hold a given size.
+ *
+ * The size is rounded up to the next bin boundary first, so that any block
+ * found through the bitmaps fits without walking the bin (good fit).
+ *
+ * @param size The required size of the payload.
+ * @param fl Receives the first-level index.
+ * @param sl Receives the second-level index.
+ */
+static void size_to_search_bin(size_t size, int *fl, int *sl) {
+    size_to_bin(search_size(size), fl, sl);
+}
 
-    // Get a pointer to the block header.
-    Block *b = (Block*)((char*)ptr - sizeof(Block));
+/**
+ * @brief Returns the idle stamp of a free block of at least PURGE_MIN bytes.
+ *
+ * The stamp is the decay epoch in which the block entered the bins and sits
+ * right after the free list links.
+ *
+ * @param b A pointer to the block.
+ * @return A pointer to the stamp.
+ */
+static size_t *block_stamp(Block *b) { return (size_t*)(b + 1); }
 
-    // Check for double-free.
-    if (b->free) {
-        fprintf(stderr, "my_free: double free or free of already free block %p\n", ptr);
-        return;
-    }
+/**
+ * @brief Returns the tree links of a free block in a tree bin.
+ * @param b A pointer to the block.
+ * @return A pointer to the links, right after the idle stamp.
+ */
+static TreeLinks *tree_links(const Block *b) { return (TreeLinks*)((size_t*)(b + 1) + 1); }
 
-    // Mark the block as free and coalesce it with its neighbors.
-    b->free = 1;
-    coalesce(b);
+/**
+ * @brief Returns the parent of a tree node.
+ * @param b A node.
+ * @return The parent, or NULL for the root.
+ */
+static Block *tree_parent(const Block *b) {
+    return (Block*)(tree_links(b)->parent & ~(uintptr_t)TREE_RED);
 }
 
 /**
- * @brief Allocates and zeros out a block of memory.
- * @param n The number of elements to allocate.
- * @param s The size of each element.
- * @return A pointer to the allocated and zeroed memory, or NULL on failure.
+ * @brief Checks whether a tree node is red.
+ * @param b A node, or NULL for a leaf.
+ * @return Non-zero if the node is red; leaves are black.
  */
-void *my_calloc(size_t n, size_t s) {
-    size_t total = n * s;
-    void *p = my_malloc(total);
-    if (p) memset(p, 0, total);
-    return p;
+static int tree_red(const Block *b) { return b && (tree_links(b)->parent & TREE_RED); }
+
+/**
+ * @brief Sets the parent of a tree node, keeping its color.
+ * @param b A node.
+ * @param parent The new parent, or NULL.
+ */
+static void tree_set_parent(Block *b, Block *parent) {
+    TreeLinks *l = tree_links(b);
+    l->parent = (uintptr_t)parent | (l->parent & TREE_RED);
 }
 
 /**
- * @brief Resizes a previously allocated block of memory.
- * @param ptr A pointer to the memory to resize.
- * @param size The new size of the memory block.
- * @return A pointer to the resized memory block, or NULL on failure.
+ * @brief Sets the color of a tree node.
+ * @param b A node.
+ * @param red 1 for red, 0 for black.
  */
-void *my_realloc(void *ptr, size_t size) {
-    if (!ptr) return my_malloc(size);
+static void tree_set_red(Block *b, int red) {
+    TreeLinks *l = tree_links(b);
+    l->parent = (l->parent & ~(uintptr_t)TREE_RED) | (uintptr_t)red;
+}
 
-    Block *b = (Block*)((char*)ptr - sizeof(Block));
-    if (b->size >= size) return ptr;
+/**
+ * @brief Points the parent of a node, or the root, at another node.
+ * @param root The root of the tree.
+ * @param old The node being replaced.
+ * @param node Its replacement, or NULL.
+ */
+static void tree_replace(Block **root, Block *old, Block *node) {
+    Block *p = tree_parent(old);
+    if (!p) *root = node;
+    else tree_links(p)->child[tree_links(p)->child[1] == old] = node;
+}
 
-    // Allocate a new block, copy the data, and free the old block.
-    void *newp = my_malloc(size);
-    if (!newp) return NULL;
-    memcpy(newp, ptr, b->size);
-    my_free(ptr);
-    return newp;
+/**
+ * @brief Rotates a subtree.
+ * @param root The root of the tree.
+ * @param x The root of the subtree.
+ * @param dir 0 to rotate left, so that x's right child takes its place, or
+ *            1 to rotate right.
+ */
+static void tree_rotate(Block **root, Block *x, int dir) {
+    TreeLinks *xl = tree_links(x);
+    Block *y = xl->child[!dir];
+    TreeLinks *yl = tree_links(y);
+    xl->child[!dir] = yl->child[dir];
+    if (yl->child[dir]) tree_set_parent(yl->child[dir], x);
+    tree_replace(root, x, y);
+    tree_set_parent(y, tree_parent(x));
+    yl->child[dir] = x;
+    tree_set_parent(x, y);
 }
 
 /**
- * @brief Dumps the current state of the heap to the console.
- *
- * This function prints the contents of each bin in the segregated free list.
+ * @brief Orders tree nodes by size, then by address.
+ * @param a A node.
+ * @param b Another node.
+ * @return Non-zero if a comes before b.
  */
-void my_dump() {
-    printf("=== Heap bins ===\n");
-    for (int i=0;i<NUM_BINS;i++) {
-        printf("Bin[%d]: ", i);
-        Block *b = bin[i];
-        while (b) {
-            printf("[%zu]", b->size);
-            if (b->next_free) printf("->");
-            b = b->next_free;
-        }
-        printf("\n");
-    }
-}
\ No newline at end of file
+static int tree_less(const Block *a, const Block *b) {
+    return block_size(a) < block_size(b) || (block_size(a) == block_size(b) && a < b);
+}
+
+/**
+ * @brief Returns the first node of a subtree.
+ * @param b The root of the subtree, or NULL.
+ * @return The smallest node at the lowest address, or NULL.
+ */
+static Block *tree_first(Block *b) {
+    if (b) {
+        while (tree_links(b)->child[0]) b = tree_links(b)->child[0];
+    }
+    return b;
+}
+
+/**
+ * @brief Adds a free block to a tree and rebalances it.
+ * @param root The root of the tree.
+ * @param b The block.
+ */
+static void tree_insert(Block **root, Block *b) {
+    TreeLinks *bl = tree_links(b);
+    Block *p = NULL;
+    int dir = 0;
+    for (Block *cur = *root; cur; cur = tree_links(cur)->child[dir]) {
+        p = cur;
+        dir = tree_less(cur, b);
+    }
+    bl->child[0] = bl->child[1] = NULL;
+    bl->parent = (uintptr_t)p | TREE_RED;
+    if (!p) *root = b;
+    else tree_links(p)->child[dir] = b;
+
+    // Repair red nodes with red parents on the way up.
+    while (tree_red(p = tree_parent(b))) {
+        Block *g = tree_parent(p);
+        int side = tree_links(g)->child[1] == p;
+        Block *uncle = tree_links(g)->child[!side];
+        if (tree_red(uncle)) {
+            tree_set_red(p, 0);
+            tree_set_red(uncle, 0);
+            tree_set_red(g, 1);
+            b = g;
+            continue;
+        }
+        if (tree_links(p)->child[!side] == b) {
+            tree_rotate(root, p, side);
+            b = p;
+            p = tree_parent(b);
+        }
+        tree_set_red(p, 0);
+        tree_set_red(g, 1);
+        tree_rotate(root, g, !side);
+    }
+    tree_set_red(*root, 0);
+}
+
+/**
+ * @brief Removes a block from a tree and rebalances it.
+ * @param root The root of the tree.
+ * @param z The block, which must be in the tree.
+ */
+static void tree_remove(Block **root, Block *z) {
+    TreeLinks *zl = tree_links(z);
+    Block *x, *xp;
+    int red;
+    if (!zl->child[0] || !zl->child[1]) {
+        // Splice the node out; its only child, if any, takes its place.
+        x = zl->child[zl->child[0] == NULL];
+        xp = tree_parent(z);
+        red = tree_red(z);
+        tree_replace(root, z, x);
+        if (x) tree_set_parent(x, xp);
+    } else {
+        // Move the node's successor into its place.
+        Block *y = tree_first(zl->child[1]);
+        TreeLinks *yl = tree_links(y);
+        red = tree_red(y);
+        x = yl->child[1];
+        if (tree_parent(y) == z) {
+            xp = y;
+        } else {
+            xp = tree_parent(y);
+            tree_links(xp)->child[0] = x;
+            if (x) tree_set_parent(x, xp);
+            yl->child[1] = zl->child[1];
+            tree_set_parent(yl->child[1], y);
+        }
+        tree_replace(root, z, y);
+        yl->child[0] = zl->child[0];
+        tree_set_parent(yl->child[0], y);
+        yl->parent = zl->parent;
+    }
+    if (red) return;
+
+    // A black node left its path, so x's side is one black node short.
+    while (x != *root && !tree_red(x)) {
+        int side = tree_links(xp)->child[1] == x;
+        Block *w = tree_links(xp)->child[!side];
+        if (tree_red(w)) {
+            tree_set_red(w, 0);
+            tree_set_red(xp, 1);
+            tree_rotate(root, xp, side);
+            w = tree_links(xp)->child[!side];
+        }
+        TreeLinks *wl = tree_links(w);
+        if (!tree_red(wl->child[0]) && !tree_red(wl->child[1])) {
+            tree_set_red(w, 1);
+            x = xp;
+            xp = tree_parent(x);
+            continue;
+        }
+        if (!tree_red(wl->child[!side])) {
+            tree_set_red(wl->child[side], 0);
+            tree_set_red(w, 1);
+            tree_rotate(root, w, !side);
+            w = tree_links(xp)->child[!side];
+            wl = tree_links(w);
+        }
+        tree_set_red(w, tree_red(xp));
+        tree_set_red(xp, 0);
+        tree_set_red(wl->child[!side], 0);
+        tree_rotate(root, xp, side);
+        x = *root;
+    }
+    if (x) tree_set_red(x, 0);
+}
+
+/**
+ * @brief Finds the smallest block of a tree that holds a given size.
+ * @param b The root of the tree.
+ * @param size The required size of the payload.
+ * @param probes Incremented for every node visited.
+ * @return The smallest fitting block at the lowest address, or NULL.
+ */
+static Block *tree_fit(Block *b, size_t size, int *probes) {
+    Block *best = NULL;
+    while (b) {
+        (*probes)++;
+        int fits = block_size(b) >= size;
+        if (fits) best = b;
+        b = tree_links(b)->child[!fits];
+    }
+    return best;
+}
+
+/**
+ * @brief Finds the whole pages of a block that purging returns to the kernel.
+ *
+ * The range leaves out the free list links, the idle stamp and the tree
+ * links at the start of the payload, and the next block's header at its
+ * end, so a purged block stays a valid free block.
+ *
+ * @param b A pointer to the block.
+ * @param lo Receives the start of the first page.
+ * @param hi Receives the end of the last page.
+ * @return Non-zero if the range holds at least one page.
+ */
+static int purge_range(const Block *b, char **lo, char **hi) {
+    uintptr_t start = (uintptr_t)(tree_links(b) + 1);
+    uintptr_t end = (uintptr_t)b + BLOCK_HEADER + block_size(b);
+    start = (start + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+    end &= ~(uintptr_t)(PAGE_SIZE - 1);
+    *lo = (char*)start;
+    *hi = (char*)end;
+    return end > start;
+}
+
+/**
+ * @brief Inserts a block into the appropriate free list.
+ * @param nd The node that owns the bins.
+ * @param b A pointer to the block to insert.
+ */
+static void insert_free(Node *nd, Block *b) {
+    int fl, sl;
+    size_to_bin(block_size(b), &fl, &sl);
+    if (fl >= FL_COUNT) corrupt("block too large for the bins", b);
+    store_link(&b->prev_free, NULL);
+    store_link(&b->next_free, nd->bin[fl][sl]);
+    if (nd->bin[fl][sl]) store_link(&nd->bin[fl][sl]->prev_free, b);
+    nd->bin[fl][sl] = b;
+    nd->fl_bitmap |= 1u << fl;
+    nd->sl_bitmap[fl] |= 1u << sl;
+    if (block_size(b) >= PURGE_MIN) *block_stamp(b) = nd->epoch;
+    if (fl >= TREE_FL) tree_insert(&nd->tree[fl][sl], b);
+}
+
+/**
+ * @brief Removes a block from its free list.
+ * @param nd The node that owns the bins.
+ * @param b A pointer to the block to remove.
+ */
+static void remove_free(Node *nd, Block *b) {
+    check_block(b);
+    int fl, sl;
+    size_to_bin(block_size(b), &fl, &sl);
+    if (fl >= FL_COUNT) corrupt("block too large for the bins", b);
+    Block *prev = load_link(&b->prev_free), *next = load_link(&b->next_free);
+    if (prev) store_link(&prev->next_free, next);
+    else nd->bin[fl][sl] = next;
+    if (next) store_link(&next->prev_free, prev);
+    store_link(&b->prev_free, NULL);
+    store_link(&b->next_free, NULL);
+    if (fl >= TREE_FL) tree_remove(&nd->tree[fl][sl], b);
+
+    // Clear the bitmap bits once the bin (and maybe its class) is empty.
+    if (!nd->bin[fl][sl]) {
+        nd->sl_bitmap[fl] &= ~(1u << sl);
+        if (!nd->sl_bitmap[fl]) nd->fl_bitmap &= ~(1u << fl);
+    }
+}
+
+/**
+ * @brief Finds the first non-empty bin at or above a given bin.
+ * @param nd The node that owns the bins.
+ * @param fl The first-level index to start from.
+ * @param sl The second-level index to start from.
+ * @param probes Incremented for every bitmap level searched.
+ * @return The first block of that bin, the smallest for a tree bin, or
+ *         NULL if there is none.
+ */
+static Block *find_bin(Node *nd, int fl, int sl, int *probes) {
+    if (fl >= FL_COUNT) return NULL;
+
+    // Look for a non-empty bin in the same class first, then in the
+    // smallest non-empty larger class.
+    (*probes)++;
+    uint32_t sl_map = nd->sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map) {
+        (*probes)++;
+        uint32_t fl_map = fl + 1 < 32 ? nd->fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (!fl_map) return NULL;
+        fl = __builtin_ctz(fl_map);
+        sl_map = nd->sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    return fl >= TREE_FL ? tree_first(nd->tree[fl][sl]) : nd->bin[fl][sl];
+}
+
+/**
+ * @brief Finds a suitable free block for a given size.
+ *
+ * Below the tree bins, this function looks up the first non-empty bin whose
+ * blocks are all large enough to hold the requested size, in constant time.
+ * From there on it takes the best fit in O(log n): the smallest block that
+ * is large enough in the size's own bin, or else the smallest block of the
+ * next non-empty bin, with ties going to the lowest address.
+ *
+ * @param nd The node that owns the bins.
+ * @param size The required size of the payload.
+ * @return A pointer to a suitable free block, or NULL if none is found.
+ */
+static Block* find_fit(Node *nd, size_t size) {
+    int fl, sl;
+    int probes = 0;
+    Block *b;
+    size_to_bin(size, &fl, &sl);
+    if (fl >= TREE_FL && fl < FL_COUNT) {
+        b = tree_fit(nd->tree[fl][sl], size, &probes);
+        if (!b) b = find_bin(nd, fl, sl + 1, &probes);
+    } else {
+        size_to_search_bin(size, &fl, &sl);
+        b = find_bin(nd, fl, sl, &probes);
+    }
+    stat_probes(probes ? probes : 1);
+    return b;
+}
+
+/**
+ * @brief Maps memory from the OS aligned to CHUNK_SIZE.
+ * @param size The number of bytes to map, a multiple of CHUNK_SIZE.
+ * @return The mapping, or NULL on failure.
+ */
+static void *os_map_aligned(size_t size) {
+    int huge = atomic_load_explicit(&map_hugepages, memory_order_relaxed);
+#ifdef HUGETLB_FLAGS
+    // Pool pages are CHUNK_SIZE long, so the mapping comes aligned. Fall
+    // back to transparent huge pages while the pool is empty.
+    if (huge == MY_HUGEPAGES_EXPLICIT) {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | HUGETLB_FLAGS, -1, 0);
+        if (p != MAP_FAILED) return p;
+    }
+#endif
+
+    // Over-map by one chunk and trim the misaligned head and the tail.
+    unsigned char *p = mmap(NULL, size + CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    uintptr_t aligned = ((uintptr_t)p + CHUNK_SIZE - 1) & ~(uintptr_t)(CHUNK_SIZE - 1);
+    size_t head = aligned - (uintptr_t)p;
+    if (head) munmap(p, head);
+    if (CHUNK_SIZE - head) munmap((unsigned char*)aligned + size, CHUNK_SIZE - head);
+#ifdef MADV_HUGEPAGE
+    // Chunks are CHUNK_SIZE-aligned, so every 2 MB of them can be a huge page.
+    if (huge != MY_HUGEPAGES_NONE) madvise((void*)aligned, size, MADV_HUGEPAGE);
+#endif
+    return (void*)aligned;
+}
+
+/**
+ * @brief Faults in every page of a new mapping, so that its first use does not.
+ *
+ * This runs after the mapping is bound to its node, so that the pages come
+ * from the node's memory, and before anything is written to it.
+ *
+ * @param p The mapping.
+ * @param size The size of the mapping.
+ */
+static void os_populate(void *p, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(p, size, MADV_POPULATE_WRITE) == 0) return;
+#endif
+    // Kernels before 5.14 lack MADV_POPULATE_WRITE; touch every page instead.
+    for (size_t off = 0; off < size; off += PAGE_SIZE) ((volatile char*)p)[off] = 0;
+}
+
+/**
+ * @brief Finds the heap chunk that owns an address.
+ * @param ptr Any address.
+ * @return The chunk covering ptr, or NULL if ptr is not in the heap.
+ */
+static Chunk *chunk_of(const void *ptr) {
+    uintptr_t key = (uintptr_t)ptr >> CHUNK_SHIFT;
+    if (key >> (MAP_ROOT_BITS + MAP_LEAF_BITS)) return NULL;
+    Chunk **leaf = chunk_map[key >> MAP_LEAF_BITS];
+    return leaf ? leaf[key & (((uintptr_t)1 << MAP_LEAF_BITS) - 1)] : NULL;
+}
+
+/**
+ * @brief Points every chunk map key covered by a chunk at it.
+ * @param ch The chunk to register.
+ * @return 1 on success, 0 if a radix tree leaf could not be mapped.
+ */
+static int chunk_map_register(Chunk *ch) {
+    uintptr_t first = (uintptr_t)ch >> CHUNK_SHIFT;
+    uintptr_t last = ((uintptr_t)ch + ch->size - 1) >> CHUNK_SHIFT;
+    int ok = 1;
+    pthread_mutex_lock(&map_lock);
+    for (uintptr_t key = first; key <= last && ok; key++) {
+        Chunk ***root = &chunk_map[key >> MAP_LEAF_BITS];
+        if (!*root) {
+            void *leaf = mmap(NULL, sizeof(Chunk*) << MAP_LEAF_BITS, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (leaf == MAP_FAILED) ok = 0;
+            else *root = leaf;
+        }
+        if (ok) (*root)[key & (((uintptr_t)1 << MAP_LEAF_BITS) - 1)] = ch;
+    }
+    pthread_mutex_unlock(&map_lock);
+    return ok;
+}
+
+/**
+ * @brief Clears the chunk map keys covered by a chunk that is going away.
+ * @param ch The chunk.
+ */
+static void chunk_map_unregister(Chunk *ch) {
+    uintptr_t first = (uintptr_t)ch >> CHUNK_SHIFT;
+    uintptr_t last = ((uintptr_t)ch + ch->size - 1) >> CHUNK_SHIFT;
+    pthread_mutex_lock(&map_lock);
+    for (uintptr_t key = first; key <= last; key++) {
+        chunk_map[key >> MAP_LEAF_BITS][key & (((uintptr_t)1 << MAP_LEAF_BITS) - 1)] = NULL;
+    }
+    pthread_mutex_unlock(&map_lock);
+}
+
+/**
+ * @brief Asks the kernel to back a range of memory from a NUMA node.
+ *
+ * The policy is only a preference, so allocations still succeed from other
+ * nodes once this one is full. Nothing is done on single-node systems.
+ *
+ * @param addr The page-aligned start of the range.
+ * @param len The length of the range.
+ * @param node The node number.
+ */
+static void numa_bind(void *addr, size_t len, int node) {
+    if (num_nodes < 2) return;
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+}
+
+/**
+ * @brief Counts the NUMA nodes from /sys, without using stdio.
+ * @return The number of possible nodes, clamped to 1..MAX_NODES.
+ */
+static int count_nodes(void) {
+    char buf[256];
+    int fd = open("/sys/devices/system/node/possible", O_RDONLY);
+    if (fd < 0) return 1;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return 1;
+
+    // The file lists ranges like "0-1,4"; the highest number wins.
+    int max = 0, cur = 0;
+    for (ssize_t i = 0; i < len; i++) {
+        if (buf[i] >= '0' && buf[i] <= '9') {
+            cur = cur * 10 + (buf[i] - '0');
+            if (cur > max) max = cur;
+        } else {
+            cur = 0;
+        }
+    }
+    return max + 1 < MAX_NODES ? max + 1 : MAX_NODES;
+}
+
+/**
+ * @brief Rounds a requested heap size to the size of a first chunk.
+ * @param size The size, at most MAX_HEAP_CHUNK.
+ * @return The size rounded up to a multiple of CHUNK_SIZE, at least CHUNK_SIZE.
+ */
+static size_t first_chunk_size(size_t size) {
+    return size <= CHUNK_SIZE ? CHUNK_SIZE : (size + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+}
+
+/**
+ * @brief Reads a size from the environment.
+ *
+ * Like the rest of nodes_init this must not allocate, which getenv and
+ * strtoull do not.
+ *
+ * @param name The variable.
+ * @param value Receives the size; a k, m or g suffix scales it.
+ * @return 1 if the variable holds a size, 0 otherwise.
+ */
+static int env_size(const char *name, size_t *value) {
+    const char *s = getenv(name);
+    if (!s || *s < '0' || *s > '9') return 0;
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end || v > (SIZE_MAX >> shift)) return 0;
+    *value = (size_t)v << shift;
+    return 1;
+}
+
+/**
+ * @brief Reads the kind of pages to back chunks with from the environment.
+ * @return The MY_HUGEPAGES_ value MYMALLOC_HUGEPAGES names.
+ */
+static int env_hugepages(void) {
+    const char *s = getenv("MYMALLOC_HUGEPAGES");
+    if (!s) return MY_HUGEPAGES_NONE;
+    if (!strcmp(s, "thp") || !strcmp(s, "1")) return MY_HUGEPAGES_THP;
+    if (!strcmp(s, "explicit") || !strcmp(s, "2")) return MY_HUGEPAGES_EXPLICIT;
+    return MY_HUGEPAGES_NONE;
+}
+
+/**
+ * @brief Writes a whole buffer to a file, retrying short writes.
+ * @param fd The file.
+ * @param buf The bytes.
+ * @param len Their number.
+ * @return 1 on success, 0 on an error.
+ */
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+/**
+ * @brief Takes the right to write a trace ring's records out.
+ * @param r The ring.
+ */
+static void trace_lock(TraceRing *r) {
+    while (atomic_flag_test_and_set_explicit(&r->busy, memory_order_acquire)) sched_yield();
+}
+
+/**
+ * @brief Releases what trace_lock took.
+ * @param r The ring.
+ */
+static void trace_unlock(TraceRing *r) {
+    atomic_flag_clear_explicit(&r->busy, memory_order_release);
+}
+
+/**
+ * @brief Appends the records a ring holds to the trace file.
+ *
+ * The file is opened with O_APPEND, so every write lands whole after the
+ * others and the threads need no lock between them. Records are dropped if
+ * the trace has stopped. The caller must hold the ring's busy flag.
+ *
+ * @param r The ring.
+ */
+static void trace_write(TraceRing *r) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    int fd = atomic_load_explicit(&trace_fd, memory_order_relaxed);
+    while (tail < head) {
+        size_t i = tail % TRACE_RING, n = head - tail;
+        if (n > TRACE_RING - i) n = TRACE_RING - i;
+        if (fd >= 0) write_all(fd, &r->rec[i], n * sizeof(r->rec[0]));
+        tail += n;
+    }
+    atomic_store_explicit(&r->tail, tail, memory_order_release);
+}
+
+/**
+ * @brief Writes out and gives up an exiting thread's trace ring.
+ * @param arg The ring.
+ */
+static void trace_release(void *arg) {
+    TraceRing *r = arg;
+    trace_lock(r);
+    trace_write(r);
+    trace_unlock(r);
+    tring = NULL;
+    atomic_store_explicit(&r->owned, 0, memory_order_release);
+}
+
+/**
+ * @brief Creates the key used to give up trace rings on thread exit.
+ */
+static void trace_key_init(void) {
+    pthread_key_create(&trace_key, trace_release);
+}
+
+/**
+ * @brief Gives the calling thread a trace ring, a given up one or a new one.
+ *
+ * Rings are mapped directly, since the allocator may be malloc itself.
+ *
+ * @return The ring, or NULL if out of memory.
+ */
+static TraceRing *trace_ring_acquire(void) {
+    pthread_once(&trace_key_once, trace_key_init);
+    TraceRing *r = atomic_load_explicit(&trace_rings, memory_order_acquire);
+    for (; r; r = r->next) {
+        int unowned = 0;
+        if (atomic_compare_exchange_strong_explicit(&r->owned, &unowned, 1, memory_order_acquire,
+                                                    memory_order_relaxed)) {
+            break;
+        }
+    }
+    if (!r) {
+        r = mmap(NULL, sizeof(TraceRing), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (r == MAP_FAILED) return NULL;
+        atomic_store_explicit(&r->owned, 1, memory_order_relaxed);
+        atomic_flag_clear(&r->busy);
+        r->next = atomic_load_explicit(&trace_rings, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&trace_rings, &r->next, r, memory_order_release,
+                                                      memory_order_relaxed)) {
+        }
+    }
+    r->thread = atomic_fetch_add_explicit(&trace_threads, 1, memory_order_relaxed);
+    // Set before the key: pthread_setspecific may allocate, and so trace.
+    tring = r;
+    pthread_setspecific(trace_key, r);
+    return r;
+}
+
+/**
+ * @brief Adds a record to the calling thread's trace ring.
+ * @param op The kind of operation, e.g. MY_TRACE_MALLOC.
+ * @param ptr The pointer allocated, freed or returned by realloc.
+ * @param old The pointer given to realloc, or NULL.
+ * @param size The requested size.
+ */
+static void trace_record(int op, const void *ptr, const void *old, size_t size) {
+    TraceRing *r = tring ? tring : trace_ring_acquire();
+    if (!r) return;
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == TRACE_RING) {
+        trace_lock(r);
+        trace_write(r);
+        trace_unlock(r);
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    struct my_trace_record *t = &r->rec[head % TRACE_RING];
+    t->time = now - atomic_load_explicit(&trace_epoch, memory_order_relaxed);
+    t->ptr = (uintptr_t)ptr;
+    t->old = (uintptr_t)old;
+    t->size = size;
+    t->thread = r->thread;
+    t->op = (uint32_t)op;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Traces an operation if tracing is on.
+ *
+ * Failed allocations are not traced, nor what my_realloc does inside.
+ *
+ * @param op The kind of operation, e.g. MY_TRACE_MALLOC.
+ * @param ptr The pointer allocated, freed or returned by realloc.
+ * @param old The pointer given to realloc, or NULL.
+ * @param size The requested size.
+ */
+static inline void trace_op(int op, const void *ptr, const void *old, size_t size) {
+    if (!atomic_load_explicit(&trace_on, memory_order_acquire) || !ptr || in_realloc) return;
+    trace_record(op, ptr, old, size);
+}
+
+/**
+ * @brief Stops tracing and writes every thread's remaining records out.
+ *
+ * Operations that race with the call may or may not make it into the trace.
+ */
+void my_trace_stop(void) {
+    atomic_store_explicit(&trace_on, 0, memory_order_relaxed);
+    TraceRing *first = atomic_load_explicit(&trace_rings, memory_order_acquire);
+    for (TraceRing *r = first; r; r = r->next) {
+        trace_lock(r);
+        trace_write(r);
+    }
+    // Every ring is held, so nobody is writing to the file.
+    int fd = atomic_exchange_explicit(&trace_fd, -1, memory_order_relaxed);
+    for (TraceRing *r = first; r; r = r->next) trace_unlock(r);
+    if (fd >= 0) close(fd);
+}
+
+/**
+ * @brief Starts tracing every allocation, free and realloc to a file.
+ *
+ * A trace already running is stopped first. Like nodes_init, which calls
+ * it for MYMALLOC_TRACE, this does not allocate.
+ *
+ * @param path The file to write, truncated first.
+ * @return 1 on success, 0 if the file could not be written.
+ */
+int my_trace_start(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) return 0;
+    struct my_trace_header header;
+    memcpy(header.magic, MY_TRACE_MAGIC, sizeof(header.magic));
+    if (!write_all(fd, &header, sizeof(header))) {
+        close(fd);
+        return 0;
+    }
+    my_trace_stop();
+
+    // Records left over from an earlier trace do not belong in this one.
+    for (TraceRing *r = atomic_load_explicit(&trace_rings, memory_order_acquire); r; r = r->next) {
+        trace_lock(r);
+        atomic_store_explicit(&r->tail, atomic_load_explicit(&r->head, memory_order_acquire),
+                              memory_order_release);
+        trace_unlock(r);
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    atomic_store_explicit(&trace_epoch, (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec,
+                          memory_order_relaxed);
+    atomic_store_explicit(&trace_fd, fd, memory_order_relaxed);
+    atomic_store_explicit(&trace_on, 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Writes out a trace that is still running when the program exits.
+ */
+static __attribute__((destructor)) void trace_exit(void) {
+    if (atomic_load_explicit(&trace_fd, memory_order_relaxed) >= 0) my_trace_stop();
+}
+
+/**
+ * @brief Sets up a node's locks and sizes.
+ * @param nd The node, zeroed.
+ * @param id The NUMA node its memory is bound to.
+ * @param first The size of its first chunk.
+ */
+static void node_init(Node *nd, int id, size_t first) {
+    pthread_mutex_init(&nd->lock, NULL);
+    for (int j = 0; j < FAST_BINS; j++) pthread_spin_init(&nd->fast[j].lock, PTHREAD_PROCESS_PRIVATE);
+    nd->next_chunk_size = first;
+    nd->id = id;
+}
+
+/**
+ * @brief Takes a node's lock, then the locks of its fastbins, as consolidate does.
+ * @param nd The node.
+ */
+static void node_lock_all(Node *nd) {
+    pthread_mutex_lock(&nd->lock);
+    for (int j = 0; j < FAST_BINS; j++) pthread_spin_lock(&nd->fast[j].lock);
+}
+
+/**
+ * @brief Releases the locks taken by node_lock_all.
+ * @param nd The node.
+ */
+static void node_unlock_all(Node *nd) {
+    for (int j = FAST_BINS - 1; j >= 0; j--) pthread_spin_unlock(&nd->fast[j].lock);
+    pthread_mutex_unlock(&nd->lock);
+}
+
+/**
+ * @brief Takes every allocator lock before fork, so none is mid-update.
+ *
+ * Node locks are taken before their fastbin locks and before map_lock, as
+ * heap_grow does; the other locks are never held together with any lock.
+ */
+static void fork_prepare(void) {
+    pthread_mutex_lock(&quarantine_lock);
+    pthread_mutex_lock(&profile_lock);
+    pthread_mutex_lock(&stats_lock);
+    for (int i = 0; i < MAX_NODES; i++) node_lock_all(&nodes[i]);
+    pthread_mutex_lock(&heaps_lock);
+    for (my_heap_t *h = live_heaps; h; h = h->next) node_lock_all(&h->node);
+    pthread_mutex_lock(&map_lock);
+    pthread_mutex_lock(&huge_lock);
+    for (TraceRing *r = atomic_load_explicit(&trace_rings, memory_order_acquire); r; r = r->next) trace_lock(r);
+}
+
+/**
+ * @brief Releases the locks taken by fork_prepare, in the parent and the child.
+ *
+ * The child only has the forking thread, which is the one holding the
+ * locks. The heaps of the threads that did not survive keep their runs, so
+ * their objects simply stay allocated in the child.
+ */
+static void fork_release(void) {
+    for (TraceRing *r = atomic_load_explicit(&trace_rings, memory_order_acquire); r; r = r->next) trace_unlock(r);
+    pthread_mutex_unlock(&huge_lock);
+    pthread_mutex_unlock(&map_lock);
+    for (my_heap_t *h = live_heaps; h; h = h->next) node_unlock_all(&h->node);
+    pthread_mutex_unlock(&heaps_lock);
+    for (int i = MAX_NODES - 1; i >= 0; i--) node_unlock_all(&nodes[i]);
+    pthread_mutex_unlock(&stats_lock);
+    pthread_mutex_unlock(&profile_lock);
+    pthread_mutex_unlock(&quarantine_lock);
+}
+
+/**
+ * @brief Releases the fork locks in the child, which stops tracing.
+ *
+ * Its records would otherwise mix with the parent's in the same file.
+ */
+static void fork_child(void) {
+    fork_release();
+    atomic_store_explicit(&trace_on, 0, memory_order_relaxed);
+    int fd = atomic_exchange_explicit(&trace_fd, -1, memory_order_relaxed);
+    if (fd >= 0) close(fd);
+}
+
+/**
+ * @brief Sets up the per-node heaps.
+ *
+ * This runs on the first allocation, which may come from the dynamic loader
+ * or libc itself when the allocator is preloaded, so it must not allocate.
+ */
+static void nodes_init(void) {
+    if (HARDENED) {
+        uintptr_t seed;
+        if (getentropy(&seed, sizeof(seed)) != 0) seed = (uintptr_t)&seed ^ (uintptr_t)time(NULL);
+        heap_secret = seed | (ALIGN - 1);
+    }
+    size_t first = CHUNK_SIZE, v;
+    if (env_size("MYMALLOC_HEAP_SIZE", &v) && v <= MAX_HEAP_CHUNK) first = first_chunk_size(v);
+    if (env_size("MYMALLOC_POPULATE", &v)) atomic_store_explicit(&map_populate, v != 0, memory_order_relaxed);
+    atomic_store_explicit(&map_hugepages, env_hugepages(), memory_order_relaxed);
+    const char *trace = getenv("MYMALLOC_TRACE");
+    if (trace && *trace) my_trace_start(trace);
+
+    num_nodes = count_nodes();
+    for (int i = 0; i < MAX_NODES; i++) node_init(&nodes[i], i, first);
+    pthread_atfork(fork_prepare, fork_release, fork_child);
+}
+
+/**
+ * @brief Returns the node the calling thread allocates from.
+ *
+ * The node is the one the thread runs on when it first allocates; a thread
+ * that migrates later keeps using it.
+ *
+ * @return The calling thread's node.
+ */
+static Node *thread_node(void) {
+    if (!tnode) {
+        pthread_once(&nodes_once, nodes_init);
+        unsigned cpu = 0, node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || node >= (unsigned)num_nodes) node = 0;
+        tnode = &nodes[node];
+    }
+    return tnode;
+}
+
+/**
+ * @brief Returns the size of a chunk's header and run map.
+ * @param size The size of the chunk mapping.
+ * @return The offset of the chunk's first block.
+ */
+static size_t chunk_header_size(size_t size) {
+    return align_up(sizeof(Chunk) + (size >> RUN_SHIFT));
+}
+
+/**
+ * @brief Grows the heap by a new chunk with a free block of at least size bytes.
+ *
+ * The chunk is bound to the memory of the node. The caller must hold nd->lock.
+ *
+ * @param nd The node that owns the bins.
+ * @param size The payload size the new free block must be able to hold.
+ * @return 1 on success, 0 if the OS refused the memory or the chunk would
+ *         exceed MAX_HEAP_CHUNK.
+ */
+static int heap_grow(Node *nd, size_t size) {
+    if (size > MAX_HEAP_CHUNK) return 0;
+    size_t map = nd->next_chunk_size;
+    if (map < size) map = (size + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+    while (map - chunk_header_size(map) - BLOCK_HEADER - BLOCK_OVERHEAD < size) {
+        map += CHUNK_SIZE;
+    }
+    if (map > MAX_HEAP_CHUNK) return 0; // No bin could hold its free block.
+
+    Chunk *ch = os_map_aligned(map);
+    if (!ch) return 0;
+    numa_bind(ch, map, nd->id);
+    if (atomic_load_explicit(&map_populate, memory_order_relaxed)) os_populate(ch, map);
+    ch->size = map;
+    ch->next = NULL;
+    ch->node = nd;
+    if (!chunk_map_register(ch)) {
+        munmap(ch, map);
+        return 0;
+    }
+    stat_mapped(map, 0);
+
+    // One free block spans the chunk, followed by the sentinel. The first
+    // block has no predecessor, so its PREV_FREE bit stays clear.
+    Block *b = (Block*)((char*)ch + chunk_header_size(map));
+    Block *end = (Block*)((char*)ch + map - BLOCK_HEADER);
+    set_head(end, 0, 0);
+    b->head = 0;
+    mark_free(b, (size_t)((char*)end - (char*)b) - BLOCK_OVERHEAD);
+    b->head |= BLOCK_PURGED; // Fresh from the kernel.
+    ch->first = b;
+    ch->sentinel = end;
+
+    // Append the chunk to the node's chunk list.
+    if (nd->last_chunk) nd->last_chunk->next = ch;
+    else nd->first_chunk = ch;
+    nd->last_chunk = ch;
+    if (nd->next_chunk_size < MAX_CHUNK_SIZE) nd->next_chunk_size *= 2;
+
+    insert_free(nd, b);
+    return 1;
+}
+
+/**
+ * @brief Merges a free block with its adjacent free neighbors.
+ *
+ * Chunks start with a block whose PREV_FREE bit is clear and end in an
+ * allocated sentinel, so neither direction can leave the chunk.
+ *
+ * @param nd The node that owns the bins.
+ * @param b A pointer to the block to coalesce, not on any free list.
+ */
+static void coalesce(Node *nd, Block *b) {
+    size_t size = block_size(b);
+
+    // Merge with the next block if it is free.
+    Block *next = next_block(b);
+    if (block_is_free(next)) {
+        remove_free(nd, next);
+        size += BLOCK_OVERHEAD + block_size(next);
+        stat_bin(STAT_COALESCE, size);
+    }
+
+    // Merge with the previous block if it is free. Its footer must agree
+    // with its header.
+    if (b->head & PREV_FREE) {
+        Block *prev = prev_block(b);
+        if (HARDENED && (!block_is_free(prev) || block_size(prev) != b->prev_size)) {
+            corrupt("corrupted footer", b);
+        }
+        remove_free(nd, prev);
+        size += BLOCK_OVERHEAD + block_size(prev);
+        stat_bin(STAT_COALESCE, size);
+        b = prev;
+    }
+
+    // Insert the coalesced block into the free list.
+    mark_free(b, size);
+    insert_free(nd, b);
+}
+
+/**
+ * @brief Returns a block to the central bins. The caller must hold nd->lock.
+ * @param nd The node that owns the bins.
+ * @param b The block to release.
+ */
+static void central_free(Node *nd, Block *b) {
+    stat_bin(STAT_FREE, block_size(b));
+    // Flag the header even if the block is merged away, so that a second
+    // free of the same pointer is still caught.
+    b->head |= BLOCK_FREE;
+    coalesce(nd, b);
+}
+
+/**
+ * @brief Returns the pages of a node's long idle free blocks to the kernel.
+ *
+ * MADV_DONTNEED rather than MADV_FREE is used, as only the former makes
+ * the pages read as zero on their next touch, which lets calloc skip them.
+ * The caller must hold nd->lock.
+ *
+ * @param nd The node.
+ * @param age Purge blocks that entered the bins more than this many epochs
+ *            ago, or all of them if 0.
+ */
+static void purge(Node *nd, size_t age) {
+    for (int fl = 0; fl < FL_COUNT; fl++) {
+        if (!(nd->fl_bitmap & (1u << fl))) continue;
+        for (int sl = 0; sl < SL_COUNT; sl++) {
+            for (Block *b = nd->bin[fl][sl]; b; b = load_link(&b->next_free)) {
+                char *lo, *hi;
+                if ((b->head & BLOCK_PURGED) || block_size(b) < PURGE_MIN) continue;
+                if (age && nd->epoch - *block_stamp(b) <= age) continue;
+                if (!purge_range(b, &lo, &hi)) continue;
+                if (madvise(lo, (size_t)(hi - lo), MADV_DONTNEED) == 0) b->head |= BLOCK_PURGED;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Returns the current time of the monotonic clock.
+ * @return The time in milliseconds.
+ */
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Starts a new decay epoch if one is due and purges what has decayed.
+ *
+ * A block is purged once DECAY_STEPS epochs of at least decay_ms /
+ * DECAY_STEPS each have begun after it entered the bins, so it has been
+ * idle for at least decay_ms. The caller must hold nd->lock.
+ *
+ * @param nd The node.
+ */
+static void decay(Node *nd) {
+    size_t ms = atomic_load_explicit(&decay_ms, memory_order_relaxed);
+    if (ms == SIZE_MAX) return;
+    uint64_t now = now_ms();
+    if (ms && now - nd->epoch_ms < ms / DECAY_STEPS) return;
+    nd->epoch_ms = now;
+    nd->epoch++;
+    purge(nd, ms ? DECAY_STEPS : 0);
+}
+
+/**
+ * @brief Counts a free towards the node's next clock check.
+ *
+ * The caller must hold nd->lock.
+ *
+ * @param nd The node.
+ */
+static void decay_tick(Node *nd) {
+    if (++nd->ticks < DECAY_TICKS) return;
+    nd->ticks = 0;
+    decay(nd);
+}
+
+/**
+ * @brief Returns the fastbin of a block size.
+ * @param size A payload size in (SLAB_MAX, FAST_MAX].
+ * @return The index of the fastbin.
+ */
+static int fast_index(size_t size) {
+    return (int)((size - SLAB_MAX - 1) / FAST_STEP);
+}
+
+/**
+ * @brief Checks whether a block that is not BLOCK_FREE waits in a fastbin.
+ * @param b A pointer to the block.
+ * @return Non-zero if the block was freed onto a fastbin.
+ */
+static int fast_holds(const Block *b) {
+    return (load_head(b) & BLOCK_FAST) != 0;
+}
+
+/**
+ * @brief Merges every block waiting in the node's fastbins into the bins.
+ *
+ * A block next to another fastbin block is merged with it once that block's
+ * turn comes. The caller must hold nd->lock; each fastbin's lock is only
+ * held to take its list.
+ *
+ * @param nd The node.
+ */
+static void consolidate(Node *nd) {
+    for (int i = 0; i < FAST_BINS; i++) {
+        FastBin *fb = &nd->fast[i];
+        if (!atomic_load_explicit(&fb->first, memory_order_relaxed)) continue;
+        pthread_spin_lock(&fb->lock);
+        Block *b = atomic_load_explicit(&fb->first, memory_order_relaxed);
+        atomic_store_explicit(&fb->first, NULL, memory_order_relaxed);
+        pthread_spin_unlock(&fb->lock);
+        while (b) {
+            Block *next = load_link(&b->next_free);
+            atomic_fetch_sub_explicit(&nd->fast_bytes, block_size(b), memory_order_relaxed);
+            central_free(nd, b);
+            b = next;
+        }
+    }
+}
+
+/**
+ * @brief Frees a mid-sized block onto its fastbin without merging it.
+ *
+ * Same-size frees and mallocs then pair up without a split or a coalesce,
+ * and without the node lock. The bins take the blocks back when a request
+ * misses or, so that they cannot pin too much memory, once FAST_LIMIT bytes
+ * wait. The caller must not hold nd->lock.
+ *
+ * @param nd The node that owns the block.
+ * @param b The allocated block, of a size in (SLAB_MAX, FAST_MAX].
+ * @param size The block's payload size.
+ * @return 1, or 0 if the block already waits in the fastbin.
+ */
+static int fast_free(Node *nd, Block *b, size_t size) {
+    FastBin *fb = &nd->fast[fast_index(size)];
+    pthread_spin_lock(&fb->lock);
+    if (fast_holds(b)) {
+        pthread_spin_unlock(&fb->lock);
+        return 0;
+    }
+    __atomic_fetch_or(&b->head, (size_t)BLOCK_FAST, __ATOMIC_RELAXED);
+    store_link(&b->next_free, atomic_load_explicit(&fb->first, memory_order_relaxed));
+    atomic_store_explicit(&fb->first, b, memory_order_relaxed);
+    pthread_spin_unlock(&fb->lock);
+
+    if (atomic_fetch_add_explicit(&nd->fast_bytes, size, memory_order_relaxed) + size > FAST_LIMIT) {
+        pthread_mutex_lock(&nd->lock);
+        if (atomic_load_explicit(&nd->fast_bytes, memory_order_relaxed) > FAST_LIMIT) consolidate(nd);
+        decay_tick(nd);
+        pthread_mutex_unlock(&nd->lock);
+    }
+    return 1;
+}
+
+/**
+ * @brief Reuses the most recently freed fastbin block that is large enough.
+ *
+ * Only the heads of the size's own fastbin and of the next one are looked
+ * at; every block in the next one is large enough. The caller must not hold
+ * nd->lock.
+ *
+ * @param nd The node.
+ * @param size The aligned payload size, in (SLAB_MAX, FAST_MAX].
+ * @return The block, now allocated, or NULL.
+ */
+static Block *fast_malloc(Node *nd, size_t size) {
+    int i = fast_index(size);
+    for (int j = i; j <= i + 1 && j < FAST_BINS; j++) {
+        FastBin *fb = &nd->fast[j];
+        if (!atomic_load_explicit(&fb->first, memory_order_relaxed)) continue;
+        pthread_spin_lock(&fb->lock);
+        Block *b = atomic_load_explicit(&fb->first, memory_order_relaxed);
+        if (b && (load_head(b) & BLOCK_SIZE_MASK) >= size) {
+            check_block(b);
+            atomic_store_explicit(&fb->first, load_link(&b->next_free), memory_order_relaxed);
+            __atomic_fetch_and(&b->head, ~(size_t)BLOCK_FAST, __ATOMIC_RELAXED);
+        } else {
+            b = NULL;
+        }
+        pthread_spin_unlock(&fb->lock);
+        if (!b) continue;
+        atomic_fetch_sub_explicit(&nd->fast_bytes, load_head(b) & BLOCK_SIZE_MASK, memory_order_relaxed);
+        return b;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocates a block, splitting it into two if it is large enough.
+ *
+ * The block is marked allocated. If it is larger than the required size, the
+ * remaining space becomes a new free block, which is inserted into the free
+ * list.
+ *
+ * @param nd The node that owns the bins.
+ * @param b The block to split, not on any free list.
+ * @param size The required size of the payload for the new allocated block.
+ */
+static void split_block(Node *nd, Block *b, size_t size) {
+    size_t remaining = block_size(b) - size;
+    if (remaining < BLOCK_OVERHEAD + ALIGN) {
+        mark_used(b, block_size(b));
+        return;
+    }
+
+    // Shrink the original block, then create a new one for the remaining space.
+    // The remainder's pages are a subset of the original's, so it stays
+    // purged if the original was.
+    stat_bin(STAT_SPLIT, block_size(b));
+    size_t purged = b->head & BLOCK_PURGED;
+    set_head(b, size, b->head & PREV_FREE);
+    Block *newb = next_block(b);
+    newb->head = 0;
+    mark_free(newb, remaining - BLOCK_OVERHEAD);
+    newb->head |= purged;
+
+    // Insert the new free block into the free list.
+    insert_free(nd, newb);
+}
+
+/**
+ * @brief Carves a block out of the central bins.
+ *
+ * The caller must hold nd->lock.
+ *
+ * @param nd The node that owns the bins.
+ * @param size The aligned payload size.
+ * @param zeroed If not NULL, set to non-zero when the block's purge_range
+ *               pages are known to read as zero.
+ * @return The allocated block, or NULL if the heap is exhausted.
+ */
+static Block *central_malloc(Node *nd, size_t size, int *zeroed) {
+    // Find a suitable free block. On a miss, merge the fastbins back into
+    // the bins before growing the heap.
+    Block *b = find_fit(nd, size);
+    if (!b && atomic_load_explicit(&nd->fast_bytes, memory_order_relaxed)) {
+        consolidate(nd);
+        b = find_fit(nd, size);
+    }
+    if (!b && heap_grow(nd, search_size(size))) b = find_fit(nd, size);
+    if (!b) return NULL; // Out of memory.
+    if (zeroed) *zeroed = (b->head & BLOCK_PURGED) != 0;
+
+    // Remove the block from the free list.
+    remove_free(nd, b);
+    // Allocate it, splitting off the rest if it is large enough.
+    split_block(nd, b, size);
+    stat_bin(STAT_MALLOC, size);
+    return b;
+}
+
+/**
+ * @brief Computes where an aligned payload would start inside a free block.
+ *
+ * The gap in front of the aligned payload must either be empty or large
+ * enough to hold a free block of its own.
+ *
+ * @param b The free block.
+ * @param align The required alignment, a power of two no smaller than ALIGN.
+ * @return The aligned payload address.
+ */
+static uintptr_t aligned_payload(Block *b, size_t align) {
+    uintptr_t payload = (uintptr_t)b + BLOCK_HEADER;
+    uintptr_t aligned = (payload + align - 1) & ~(uintptr_t)(align - 1);
+    if (aligned != payload && aligned - payload < BLOCK_OVERHEAD + ALIGN) {
+        aligned += align;
+    }
+    return aligned;
+}
+
+/**
+ * @brief Checks whether a free block can hold an aligned payload.
+ * @param b The free block.
+ * @param align The required alignment.
+ * @param size The required size of the payload.
+ * @return 1 if the payload fits, 0 otherwise.
+ */
+static int aligned_fits(Block *b, size_t align, size_t size) {
+    uintptr_t end = (uintptr_t)b + BLOCK_HEADER + block_size(b);
+    uintptr_t aligned = aligned_payload(b, align);
+    return aligned < end && end - aligned >= size;
+}
+
+/**
+ * @brief Finds a free block that can hold an aligned payload.
+ *
+ * A few blocks of the bin the size itself maps to are probed first, which
+ * lets a freed, already aligned slab run be reused as is. Failing that, the
+ * search asks for enough slack that any block found fits.
+ *
+ * @param nd The node that owns the bins.
+ * @param align The required alignment.
+ * @param size The required size of the payload.
+ * @return A pointer to a suitable free block, or NULL if none is found.
+ */
+static Block *find_aligned_fit(Node *nd, size_t align, size_t size) {
+    int fl, sl;
+    size_to_bin(size, &fl, &sl);
+    if (fl < FL_COUNT) {
+        Block *b = nd->bin[fl][sl];
+        for (int i = 0; b && i < ALIGNED_PROBES; i++, b = load_link(&b->next_free)) {
+            if (aligned_fits(b, align, size)) {
+                stat_probes(i + 1);
+                return b;
+            }
+        }
+    }
+    Block *b = find_fit(nd, size + 2 * align);
+    if (!b && atomic_load_explicit(&nd->fast_bytes, memory_order_relaxed)) {
+        consolidate(nd);
+        b = find_fit(nd, size + 2 * align);
+    }
+    if (!b && heap_grow(nd, search_size(size + 2 * align))) b = find_fit(nd, size + 2 * align);
+    return b;
+}
+
+/**
+ * @brief Carves a block whose payload is aligned to a given boundary.
+ *
+ * The padding in front of the aligned payload is split off as a free block
+ * of its own rather than wasted. The caller must hold nd->lock.
+ *
+ * @param nd The node that owns the bins.
+ * @param align The required alignment, a power of two no smaller than ALIGN.
+ * @param size The aligned payload size.
+ * @return The allocated block, or NULL if the heap is exhausted.
+ */
+static Block *central_memalign(Node *nd, size_t align, size_t size) {
+    Block *b = find_aligned_fit(nd, align, size);
+    if (!b) return NULL; // Out of memory.
+    remove_free(nd, b);
+
+    uintptr_t payload = (uintptr_t)b + BLOCK_HEADER;
+    uintptr_t aligned = aligned_payload(b, align);
+    if (aligned != payload) {
+        size_t lead = aligned - payload;
+
+        // Create the aligned block and shrink the original to the gap.
+        Block *ab = (Block*)(aligned - BLOCK_HEADER);
+        set_head(ab, block_size(b) - lead, 0);
+        mark_free(b, lead - BLOCK_OVERHEAD);
+        insert_free(nd, b);
+        b = ab;
+    }
+
+    split_block(nd, b, size);
+    stat_bin(STAT_MALLOC, size);
+    return b;
+}
+
+/**
+ * @brief Resizes an allocated block without moving it, if possible.
+ *
+ * Shrinking splits the tail off and coalesces it with a free successor.
+ * Growing absorbs a free next neighbor when the two together are large
+ * enough, and any excess is split off again. The caller must hold nd->lock.
+ *
+ * @param nd The node that owns the bins.
+ * @param b The allocated block.
+ * @param size The new, aligned payload size.
+ * @return 1 if the block now holds size bytes, 0 if it has to move.
+ */
+static int resize_block(Node *nd, Block *b, size_t size) {
+    Block *next = next_block(b);
+    if (size <= block_size(b)) {
+        split_block(nd, b, size);
+        Block *tail = next_block(b);
+        if (tail != next) {
+            // Merge the released tail with a free successor.
+            remove_free(nd, tail);
+            coalesce(nd, tail);
+        }
+        return 1;
+    }
+
+    if (!block_is_free(next)) return 0;
+    size_t total = block_size(b) + BLOCK_OVERHEAD + block_size(next);
+    if (total < size) return 0;
+
+    // Absorb the neighbor, then hand back whatever is not needed.
+    remove_free(nd, next);
+    set_head(b, total, b->head & PREV_FREE);
+    split_block(nd, b, size);
+    return 1;
+}
+
+/**
+ * @brief Carves n adjacent blocks of the same size out of one free block.
+ *
+ * Only one bin lookup and one split are done for the whole batch. The
+ * caller must hold nd->lock.
+ *
+ * @param nd The node that owns the bins.
+ * @param size The aligned payload size of each block.
+ * @param n The number of blocks.
+ * @param out Receives the n payload pointers.
+ * @return n on success, 0 if the heap is exhausted.
+ */
+static size_t central_malloc_batch(Node *nd, size_t size, size_t n, void **out) {
+    size_t stride = size + BLOCK_OVERHEAD;
+    Block *b = central_malloc(nd, n * stride - BLOCK_OVERHEAD, NULL);
+    if (!b) return 0;
+
+    // split_block may have left a little extra, which goes to the last block.
+    // Every block but the first follows an allocated one.
+    size_t extra = block_size(b) - (n * stride - BLOCK_OVERHEAD);
+    b->head &= PREV_FREE;
+    for (size_t i = 0; i < n; i++) {
+        Block *cur = (Block*)((char*)b + i * stride);
+        set_head(cur, i + 1 < n ? size : size + extra, i ? 0 : b->head);
+        out[i] = (char*)cur + BLOCK_HEADER;
+    }
+    return n;
+}
+
+/**
+ * @brief Determines the size class for a small request.
+ * @param size The requested size, at most SLAB_MAX.
+ * @return The index of the smallest class that holds size bytes.
+ */
+static int size_to_class(size_t size) {
+    // Classes are 16 bytes apart up to 128, then four per power of two.
+    if (size <= 128) return size ? (int)((size - 1) >> 4) : 0;
+    int lg = 63 - __builtin_clzll((unsigned long long)(size - 1));
+    return 8 + (lg - 7) * 4 + (int)(((size - 1) - ((size_t)1 << lg)) >> (lg - 2));
+}
+
+/**
+ * @brief Finds the slab run that owns a heap address.
+ * @param ch The chunk that owns the address.
+ * @param ptr An address inside the chunk.
+ * @return The owning run, or NULL if the address is not in a run.
+ */
+static Run *run_of(Chunk *ch, void *ptr) {
+    size_t page = (size_t)((char*)ptr - (char*)ch) >> RUN_SHIFT;
+    if (!ch->run_map[page]) return NULL;
+    return (Run*)((uintptr_t)ptr & ~(uintptr_t)(RUN_SIZE - 1));
+}
+
+/**
+ * @brief Adds a run to the front of a run list.
+ * @param list The list, either a thread heap's or the orphan list of a class.
+ * @param r The run to link.
+ */
+static void run_link(Run **list, Run *r) {
+    r->prev = NULL;
+    r->next = *list;
+    if (*list) (*list)->prev = r;
+    *list = r;
+}
+
+/**
+ * @brief Removes a run from a run list.
+ * @param list The list the run is on.
+ * @param r The run to unlink.
+ */
+static void run_unlink(Run **list, Run *r) {
+    if (r->prev) r->prev->next = r->next;
+    else *list = r->next;
+    if (r->next) r->next->prev = r->prev;
+    r->prev = r->next = NULL;
+}
+
+/**
+ * @brief Returns the node whose lock protects a run's chunk.
+ * @param r The run.
+ * @return The run's node.
+ */
+static Node *run_node(Run *r) {
+    return chunk_of(r)->node;
+}
+
+/**
+ * @brief Carves a new run for a size class. The caller must hold nd->lock.
+ * @param nd The node to carve the run from.
+ * @param c The size class.
+ * @param owner The thread heap the run is handed to, or NULL for an orphan.
+ * @return The new run, on no list yet, or NULL if out of memory.
+ */
+static Run *run_create(Node *nd, int c, ThreadHeap *owner) {
+    Block *b = central_memalign(nd, RUN_SIZE, RUN_PAYLOAD);
+    if (!b) return NULL;
+
+    Run *r = (Run*)((char*)b + BLOCK_HEADER);
+    size_t cs = class_size[c];
+    r->prev = r->next = NULL;
+    atomic_init(&r->owner, owner);
+    r->class_idx = (unsigned short)c;
+    r->nobjs = (unsigned short)((RUN_PAYLOAD - RUN_HEADER_SIZE) / cs);
+    r->nfree = r->nobjs;
+
+    // Thread the free list through the objects in address order.
+    char *obj = (char*)r + RUN_HEADER_SIZE;
+    r->free_list = obj;
+    for (unsigned i = 0; i < r->nobjs; i++) {
+        FreeObj *o = (FreeObj*)(obj + i * cs);
+        set_obj_next(o, i + 1 < r->nobjs ? (FreeObj*)(obj + (i + 1) * cs) : NULL);
+        o->key = FREE_OBJ_KEY;
+    }
+
+    Chunk *ch = chunk_of(r);
+    ch->run_map[((char*)r - (char*)ch) >> RUN_SHIFT] = 1;
+    return r;
+}
+
+/**
+ * @brief Gives an empty run back to the central bins.
+ *
+ * The run must already be off every list. The caller must hold the lock of
+ * the run's node.
+ *
+ * @param r The run to release.
+ */
+static void run_release(Run *r) {
+    Chunk *ch = chunk_of(r);
+    ch->run_map[((char*)r - (char*)ch) >> RUN_SHIFT] = 0;
+    central_free(ch->node, (Block*)((char*)r - BLOCK_HEADER));
+}
+
+/**
+ * @brief Returns an object to an orphan run.
+ *
+ * The caller must hold the lock of the run's node.
+ *
+ * A run that becomes empty is released unless it is the only orphan run of
+ * its class, which keeps one run around to absorb alloc/free ping-pong.
+ *
+ * @param r The run that owns the object.
+ * @param o The object to free.
+ */
+static void slab_free(Run *r, FreeObj *o) {
+    Run **list = &run_node(r)->partial[r->class_idx];
+    set_obj_next(o, r->free_list);
+    o->key = FREE_OBJ_KEY;
+    r->free_list = o;
+    if (r->nfree++ == 0) run_link(list, r);
+    else if (r->nfree == r->nobjs && (*list != r || r->next)) {
+        run_unlink(list, r);
+        run_release(r);
+    }
+}
+
+/**
+ * @brief Checks that a pointer is the start of one of a run's objects.
+ * @param r The run the pointer falls in.
+ * @param ptr The pointer.
+ * @return 1 if ptr is an object boundary, 0 otherwise.
+ */
+static int slab_is_object(Run *r, void *ptr) {
+    size_t offset = (size_t)((char*)ptr - (char*)r);
+    return offset >= RUN_HEADER_SIZE && (offset - RUN_HEADER_SIZE) % class_size[r->class_idx] == 0;
+}
+
+/**
+ * @brief Checks whether an object is on a free list.
+ * @param list The first object of the list.
+ * @param o The object.
+ * @return 1 if o is on the list, 0 otherwise.
+ */
+static int free_list_holds(FreeObj *list, FreeObj *o) {
+    for (FreeObj *f = list; f; f = obj_next(f)) {
+        if (f == o) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks whether an object is already free.
+ *
+ * Only called when the object carries FREE_OBJ_KEY, which user data can
+ * match by accident. For runs of the calling thread or orphan runs the free
+ * lists are scanned to confirm. The lists of a run owned by another thread
+ * cannot be walked safely, so there the key alone decides.
+ *
+ * @param r The run that owns the object.
+ * @param o The object.
+ * @return 1 if the object is free, 0 otherwise.
+ */
+static int slab_is_free(Run *r, FreeObj *o) {
+    ThreadHeap *owner = atomic_load_explicit(&r->owner, memory_order_acquire);
+    if (owner && owner == theap) {
+        // Only the owner pops the remote stack, so walking it is safe here.
+        return free_list_holds(r->free_list, o)
+            || free_list_holds(atomic_load_explicit(&owner->remote, memory_order_acquire), o);
+    }
+    if (owner) return 1;
+
+    Node *nd = run_node(r);
+    pthread_mutex_lock(&nd->lock);
+    owner = atomic_load_explicit(&r->owner, memory_order_relaxed);
+    int found = owner ? 1 : free_list_holds(r->free_list, o);
+    pthread_mutex_unlock(&nd->lock);
+    return found;
+}
+
+/**
+ * @brief Pushes an object onto another thread heap's remote-free stack.
+ * @param h The heap that owns the object's run.
+ * @param o The object.
+ */
+static void remote_push(ThreadHeap *h, FreeObj *o) {
+    o->key = FREE_OBJ_KEY;
+    FreeObj *head = atomic_load_explicit(&h->remote, memory_order_relaxed);
+    do {
+        set_obj_next(o, head);
+    } while (!atomic_compare_exchange_weak_explicit(&h->remote, &head, o,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * @brief Returns an object to a run owned by the calling thread.
+ *
+ * No lock is needed for the run itself. A run that becomes empty is released
+ * unless it is the heap's only run of its class.
+ *
+ * @param h The calling thread's heap.
+ * @param r The run that owns the object.
+ * @param o The object to free.
+ */
+static void heap_local_free(ThreadHeap *h, Run *r, FreeObj *o) {
+    Run **list = &h->runs[r->class_idx];
+    set_obj_next(o, r->free_list);
+    o->key = FREE_OBJ_KEY;
+    r->free_list = o;
+    if (r->nfree++ == 0) run_link(list, r);
+    else if (r->nfree == r->nobjs && (*list != r || r->next)) {
+        run_unlink(list, r);
+        pthread_mutex_lock(&h->node->lock);
+        run_release(r);
+        pthread_mutex_unlock(&h->node->lock);
+    }
+}
+
+/**
+ * @brief Frees a small object, wherever its run lives.
+ *
+ * The owner frees locally, other threads push onto the owner's remote stack
+ * with a CAS, and orphan runs are freed under their node's lock. The owner is checked
+ * again under the lock because a thread may adopt the run in the meantime.
+ *
+ * @param r The run that owns the object.
+ * @param o The object to free.
+ */
+static void small_free(Run *r, FreeObj *o) {
+    ThreadHeap *owner = atomic_load_explicit(&r->owner, memory_order_acquire);
+    if (!owner) {
+        Node *nd = run_node(r);
+        pthread_mutex_lock(&nd->lock);
+        owner = atomic_load_explicit(&r->owner, memory_order_relaxed);
+        if (!owner) slab_free(r, o);
+        pthread_mutex_unlock(&nd->lock);
+        if (!owner) return;
+    }
+    if (owner == theap) heap_local_free(owner, r, o);
+    else remote_push(owner, o);
+}
+
+/**
+ * @brief Frees every object other threads have pushed onto a heap.
+ *
+ * The whole stack is taken with one exchange. Objects of runs that have since
+ * changed hands are passed on to their current owner.
+ *
+ * @param h The calling thread's heap.
+ */
+static void heap_drain(ThreadHeap *h) {
+    FreeObj *o = atomic_exchange_explicit(&h->remote, NULL, memory_order_acquire);
+    while (o) {
+        FreeObj *next = obj_next(o);
+        small_free((Run*)((uintptr_t)o & ~(uintptr_t)(RUN_SIZE - 1)), o);
+        o = next;
+    }
+}
+
+/**
+ * @brief Parks an exiting thread's heap in the pool.
+ *
+ * Runs with free objects become orphans that any thread may adopt; empty ones
+ * are released. Full runs stay with the heap, so frees that race with the
+ * exit still find a live remote stack, and the next thread to take the heap
+ * from the pool inherits them.
+ *
+ * @param arg The exiting thread's heap.
+ */
+static void heap_abandon(void *arg) {
+    ThreadHeap *h = arg;
+    Node *nd = h->node;
+    heap_drain(h);
+
+    pthread_mutex_lock(&nd->lock);
+    for (int c = 0; c < NUM_CLASSES; c++) {
+        Run *r;
+        while ((r = h->runs[c])) {
+            run_unlink(&h->runs[c], r);
+            atomic_store_explicit(&r->owner, NULL, memory_order_relaxed);
+            if (r->nfree == r->nobjs) run_release(r);
+            else run_link(&nd->partial[c], r);
+        }
+    }
+    h->next = nd->heap_pool;
+    nd->heap_pool = h;
+    pthread_mutex_unlock(&nd->lock);
+    theap = NULL;
+}
+
+/**
+ * @brief Creates the key used to abandon thread heaps on thread exit.
+ */
+static void theap_key_init(void) {
+    pthread_key_create(&theap_key, heap_abandon);
+}
+
+/**
+ * @brief Gives the calling thread a heap, from its node's pool or a new block.
+ * @return The heap, or NULL if out of memory.
+ */
+static ThreadHeap *heap_acquire(void) {
+    pthread_once(&theap_key_once, theap_key_init);
+
+    Node *nd = thread_node();
+    pthread_mutex_lock(&nd->lock);
+    ThreadHeap *h = nd->heap_pool;
+    int fresh = 0;
+    if (h) {
+        nd->heap_pool = h->next;
+    } else {
+        Block *b = central_memalign(nd, CACHE_LINE, sizeof(ThreadHeap));
+        if (b) {
+            h = (ThreadHeap*)((char*)b + BLOCK_HEADER);
+            memset(h, 0, sizeof(ThreadHeap));
+            atomic_init(&h->remote, NULL);
+            h->node = nd;
+            fresh = 1;
+        }
+    }
+    pthread_mutex_unlock(&nd->lock);
+    if (!h) return NULL; // Out of memory.
+    // A pooled heap is on all_heaps already; only a new one is added, once.
+    if (fresh) {
+        pthread_mutex_lock(&stats_lock);
+        h->next_all = all_heaps;
+        all_heaps = h;
+        pthread_mutex_unlock(&stats_lock);
+    }
+
+    pthread_setspecific(theap_key, h);
+    theap = h;
+    return h;
+}
+
+/**
+ * @brief Finds a run with free objects for a heap that has none of a class.
+ *
+ * An orphan run of the heap's node is adopted if there is one, otherwise a
+ * new run is carved.
+ *
+ * @param h The calling thread's heap.
+ * @param c The size class.
+ * @return The run, now on the heap's list, or NULL if out of memory.
+ */
+static Run *heap_take_run(ThreadHeap *h, int c) {
+    Node *nd = h->node;
+    pthread_mutex_lock(&nd->lock);
+    Run *r = nd->partial[c];
+    if (r) {
+        run_unlink(&nd->partial[c], r);
+        atomic_store_explicit(&r->owner, h, memory_order_relaxed);
+    } else {
+        r = run_create(nd, c, h);
+    }
+    pthread_mutex_unlock(&nd->lock);
+    if (r) run_link(&h->runs[c], r);
+    return r;
+}
+
+/**
+ * @brief Takes a small object from the calling thread's own runs.
+ *
+ * Objects freed by other threads are only collected once the heap's runs of
+ * the class are exhausted.
+ *
+ * @param c The size class.
+ * @return The object, or NULL if out of memory.
+ */
+static void *heap_malloc(int c) {
+    ThreadHeap *h = theap;
+    if (!h && !(h = heap_acquire())) return NULL; // Out of memory.
+
+    Run *r = h->runs[c];
+    if (!r && atomic_load_explicit(&h->remote, memory_order_relaxed)) {
+        heap_drain(h);
+        r = h->runs[c];
+    }
+    if (!r && !(r = heap_take_run(h, c))) return NULL; // Out of memory.
+
+    FreeObj *o = r->free_list;
+    r->free_list = obj_next(o);
+    if (--r->nfree == 0) run_unlink(&h->runs[c], r);
+    o->key = 0;
+    stat_class(c, 0);
+    return o;
+}
+
+/**
+ * @brief Rounds the span of a huge allocation up to whole pages.
+ * @param span The size of the allocation plus its offset from the header.
+ * @return The size of the mapping.
+ */
+static size_t huge_map_size(size_t span) {
+    return (span + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+}
+
+/**
+ * @brief Returns the home slot of a huge header in the huge set.
+ * @param h The header, page-aligned.
+ * @return The index to start probing at.
+ */
+static size_t huge_hash(const Huge *h) {
+    return (size_t)(((uintptr_t)h >> PAGE_SHIFT) * 0x9e3779b97f4a7c15ULL) & (huge_slots - 1);
+}
+
+/**
+ * @brief Finds the slot holding a huge header. The caller must hold huge_lock.
+ * @param h The header.
+ * @return The slot, or NULL if h is not in the set.
+ */
+static Huge **huge_find(const Huge *h) {
+    if (!huge_slots) return NULL;
+    for (size_t i = huge_hash(h);; i = (i + 1) & (huge_slots - 1)) {
+        if (huge_set[i] == h) return &huge_set[i];
+        if (!huge_set[i]) return NULL;
+    }
+}
+
+/**
+ * @brief Adds a header to the huge set. The caller must hold huge_lock.
+ *
+ * The set is mapped directly, like the chunk map leaves, so that it never
+ * depends on the heap it indexes.
+ *
+ * @param h The header, not yet in the set.
+ * @return 1 on success, 0 if the set could not grow.
+ */
+static int huge_insert(Huge *h) {
+    if (2 * (huge_count + 1) > huge_slots) {
+        size_t slots = huge_slots ? 2 * huge_slots : PAGE_SIZE / sizeof(Huge*);
+        Huge **set = mmap(NULL, slots * sizeof(Huge*), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (set == MAP_FAILED) return 0;
+        Huge **old = huge_set;
+        size_t old_slots = huge_slots;
+        huge_set = set;
+        huge_slots = slots;
+        huge_count = 0;
+        for (size_t i = 0; i < old_slots; i++) {
+            if (old[i]) huge_insert(old[i]);
+        }
+        if (old) munmap(old, old_slots * sizeof(Huge*));
+    }
+    size_t i = huge_hash(h);
+    while (huge_set[i]) i = (i + 1) & (huge_slots - 1);
+    huge_set[i] = h;
+    huge_count++;
+    return 1;
+}
+
+/**
+ * @brief Takes a header out of the huge set. The caller must hold huge_lock.
+ *
+ * The entries after it in its probe run are shifted back, so the set needs
+ * no tombstones.
+ *
+ * @param slot The header's slot, from huge_find.
+ */
+static void huge_remove(Huge **slot) {
+    size_t mask = huge_slots - 1, i = (size_t)(slot - huge_set);
+    huge_set[i] = NULL;
+    huge_count--;
+    for (size_t j = (i + 1) & mask; huge_set[j]; j = (j + 1) & mask) {
+        // Move the entry back into the hole unless its home slot lies
+        // cyclically between the hole and where it sits.
+        size_t home = huge_hash(huge_set[j]);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            huge_set[i] = huge_set[j];
+            huge_set[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+/**
+ * @brief Records that a huge mapping is live.
+ * @param h The mapping's header.
+ * @return 1 on success, 0 if out of memory.
+ */
+static int huge_register(Huge *h) {
+    pthread_mutex_lock(&huge_lock);
+    int ok = huge_insert(h);
+    pthread_mutex_unlock(&huge_lock);
+    return ok;
+}
+
+/**
+ * @brief Forgets a huge mapping that is about to be unmapped.
+ * @param h The mapping's header.
+ * @return 1 if it was live, 0 if it was not in the set.
+ */
+static int huge_unregister(Huge *h) {
+    pthread_mutex_lock(&huge_lock);
+    Huge **slot = huge_find(h);
+    if (slot) huge_remove(slot);
+    pthread_mutex_unlock(&huge_lock);
+    return slot != NULL;
+}
+
+/**
+ * @brief Gives a huge allocation its own mapping.
+ * @param align The required alignment of the user pointer.
+ * @param size The requested size.
+ * @return A pointer to the allocated memory, or NULL on failure.
+ */
+static void *huge_alloc(size_t align, size_t size) {
+    // Aligned allocations start one page into the mapping; alignments above
+    // a page also need slack to trim the mapping to.
+    size_t off = align <= ALIGN ? sizeof(Huge) : PAGE_SIZE;
+    size_t slack = align > PAGE_SIZE ? align - PAGE_SIZE : 0;
+    if (size > SIZE_MAX - off - slack - PAGE_SIZE) return NULL;
+    size_t map = huge_map_size(off + size);
+
+    unsigned char *p = mmap(NULL, map + slack, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    if (slack) {
+        uintptr_t user = ((uintptr_t)p + off + align - 1) & ~(uintptr_t)(align - 1);
+        size_t head = user - off - (uintptr_t)p;
+        if (head) munmap(p, head);
+        if (slack - head) munmap(p + head + map, slack - head);
+        p += head;
+    }
+
+    Huge *h = (Huge*)p;
+    h->map_size = map;
+    h->magic = HUGE_MAGIC ^ (uintptr_t)h;
+    if (!huge_register(h)) {
+        munmap(p, map);
+        return NULL;
+    }
+    stat_mapped(map, 0);
+    stat_bytes(map - off, 0);
+    return p + off;
+}
+
+/**
+ * @brief Finds the huge mapping header for a pointer outside the chunks.
+ *
+ * The header is only read once the huge set says it is live, since the
+ * memory in front of a foreign pointer may not be mapped at all.
+ *
+ * @param ptr A pointer that no chunk owns.
+ * @return The header, or NULL if ptr is not a huge allocation.
+ */
+static Huge *huge_of(void *ptr) {
+    uintptr_t off = (uintptr_t)ptr & (PAGE_SIZE - 1);
+    Huge *h;
+    if (off == sizeof(Huge)) h = (Huge*)ptr - 1;
+    else if (off == 0) h = (Huge*)((char*)ptr - PAGE_SIZE);
+    else return NULL;
+    pthread_mutex_lock(&huge_lock);
+    int live = huge_find(h) != NULL;
+    pthread_mutex_unlock(&huge_lock);
+    return live && h->magic == (HUGE_MAGIC ^ (uintptr_t)h) ? h : NULL;
+}
+
+/**
+ * @brief Resizes a huge allocation, moving its pages rather than copying them.
+ * @param h The header of the allocation.
+ * @param ptr The user pointer of the allocation.
+ * @param size The new size, at least the mmap threshold.
+ * @return A pointer to the resized allocation, or NULL on failure.
+ */
+static void *huge_realloc(Huge *h, void *ptr, size_t size) {
+    size_t off = (size_t)((char*)ptr - (char*)h);
+    if (size > SIZE_MAX - off - PAGE_SIZE) return NULL;
+    size_t map = huge_map_size(off + size);
+    if (map == h->map_size) return ptr;
+    // The header leaves the huge set while the mapping may move, so that no
+    // lookup reads it meanwhile. Putting it back cannot fail, since the set
+    // had room for it before.
+    huge_unregister(h);
+#ifdef MREMAP_MAYMOVE
+    Huge *nh = mremap(h, h->map_size, map, MREMAP_MAYMOVE);
+    if (nh == MAP_FAILED) {
+        huge_register(h);
+        return NULL;
+    }
+#else
+    // Without mremap, shrink in place and grow by copying.
+    Huge *nh = h;
+    if (map < h->map_size) {
+        munmap((char*)h + map, h->map_size - map);
+    } else {
+        nh = mmap(NULL, map, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (nh == MAP_FAILED) {
+            huge_register(h);
+            return NULL;
+        }
+        memcpy(nh, h, h->map_size);
+        munmap(h, h->map_size);
+    }
+#endif
+    huge_register(nh);
+    stat_mapped(map, nh->map_size);
+    stat_bytes(map, nh->map_size);
+    nh->map_size = map;
+    nh->magic = HUGE_MAGIC ^ (uintptr_t)nh;
+    return (char*)nh + off;
+}
+
+/**
+ * @brief Returns the number of bytes usable at an allocated pointer.
+ * @param ptr A pointer returned by my_malloc.
+ * @return The usable size of the allocation, or 0 if ptr is outside the heap.
+ */
+static size_t usable_size(void *ptr) {
+    Chunk *ch = chunk_of(ptr);
+    if (!ch) {
+        Huge *h = huge_of(ptr);
+        return h ? h->map_size - (size_t)((char*)ptr - (char*)h) : 0;
+    }
+    Run *r = run_of(ch, ptr);
+    if (r) return class_size[r->class_idx];
+    return block_size((Block*)((char*)ptr - BLOCK_HEADER));
+}
+
+/**
+ * @brief Frees a small object after checking it is not already free.
+ * @param r The run that owns the object.
+ * @param ptr The object to free.
+ */
+static void small_free_checked(Run *r, void *ptr) {
+    FreeObj *o = ptr;
+    if (o->key == FREE_OBJ_KEY && slab_is_free(r, o)) {
+        fprintf(stderr, "my_free: double free or free of already free block %p\n", ptr);
+        return;
+    }
+    stat_class(r->class_idx, 1);
+    small_free(r, o);
+}
+
+/**
+ * @brief Approximates log2 of a positive, normal double.
+ * @param x The value.
+ * @return log2(x), within 1e-4.
+ */
+static double fast_log2(double x) {
+    union { double d; uint64_t u; } v = { x };
+    int e = (int)((v.u >> 52) & 0x7ff) - 1023;
+    v.u = (v.u & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1023 << 52);
+    double t = (v.d - 1.0) / (v.d + 1.0), t2 = t * t;
+    // log2(m) = 2 / ln 2 * atanh((m - 1) / (m + 1)), and |t| <= 1/3 for m in [1, 2).
+    return e + 2.8853900817779268 * t * (1.0 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 / 7)));
+}
+
+/**
+ * @brief Picks the number of bytes until the calling thread's next sample.
+ *
+ * Intervals are exponentially distributed with the profile rate as their
+ * mean, so every allocated byte is equally likely to be sampled.
+ *
+ * @param rate The mean interval.
+ * @return The interval, at least 1.
+ */
+static size_t sample_interval(size_t rate) {
+    if (!sample_rng) sample_rng = (uintptr_t)&sample_rng * 0x9e3779b97f4a7c15ULL | 1;
+    sample_rng ^= sample_rng << 13;
+    sample_rng ^= sample_rng >> 7;
+    sample_rng ^= sample_rng << 17;
+    double u = ((double)(sample_rng >> 11) + 1.0) / 9007199254740992.0;
+    double n = -fast_log2(u) * 0.6931471805599453 * (double)rate;
+    return n < 1.0 ? 1 : n > (double)(SIZE_MAX / 2) ? SIZE_MAX / 2 : (size_t)n;
+}
+
+/**
+ * @brief Hashes an allocation stack.
+ * @param stack The return addresses.
+ * @param depth The number of frames.
+ * @return The hash, never 0.
+ */
+static uint64_t stack_hash(void *const *stack, int depth) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < depth; i++) h = (h ^ (uintptr_t)stack[i]) * 0x100000001b3ULL;
+    return h ? h : 1;
+}
+
+/**
+ * @brief Finds or creates the bucket of an allocation stack.
+ *
+ * The caller must hold profile_lock.
+ *
+ * @param stack The return addresses.
+ * @param depth The number of frames.
+ * @return The bucket's index, or -1 if the table is full.
+ */
+static int profile_bucket(void *const *stack, int depth) {
+    uint64_t h = stack_hash(stack, depth);
+    for (size_t i = 0; i < PROFILE_BUCKETS; i++) {
+        ProfileBucket *b = &profile_buckets[(h + i) & (PROFILE_BUCKETS - 1)];
+        if (!b->hash) {
+            b->hash = h;
+            b->depth = depth;
+            memcpy(b->stack, stack, depth * sizeof(void*));
+            return (int)(b - profile_buckets);
+        }
+        if (b->hash == h && b->depth == depth && !memcmp(b->stack, stack, depth * sizeof(void*))) {
+            return (int)(b - profile_buckets);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Records a sampled allocation with the stack that made it.
+ *
+ * Kept out of line so that the common, unsampled path stays small.
+ *
+ * @param ptr The user pointer.
+ * @param size The requested size.
+ */
+static __attribute__((noinline)) void profile_sample(void *ptr, size_t size) {
+    if (in_sample) return;
+    in_sample = 1;
+    void *stack[PROFILE_DEPTH + 1];
+    int depth = backtrace(stack, PROFILE_DEPTH + 1) - 1;
+
+    pthread_mutex_lock(&profile_lock);
+    int bi = profile_bucket(stack + 1, depth);
+    if (bi >= 0) {
+        ProfileBucket *b = &profile_buckets[bi];
+        b->total_objs++;
+        b->total_bytes += size;
+        // Take the first free slot on the probe sequence, reusing tombstones.
+        size_t h = ((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL;
+        for (size_t i = 0; i < PROFILE_SLOTS; i++) {
+            ProfileSlot *sl = &profile_slots[(h + i) & (PROFILE_SLOTS - 1)];
+            if (atomic_load_explicit(&sl->key, memory_order_relaxed) > PROFILE_TOMBSTONE) continue;
+            sl->bucket = (uint32_t)bi;
+            sl->size = size;
+            atomic_store_explicit(&sl->key, (uintptr_t)ptr, memory_order_release);
+            atomic_fetch_add_explicit(&profile_live, 1, memory_order_release);
+            b->live_objs++;
+            b->live_bytes += size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+    in_sample = 0;
+}
+
+/**
+ * @brief Counts an allocation against the calling thread's sample countdown.
+ *
+ * Every allocating entry point ends here, so this also traces it.
+ *
+ * @param ptr The allocation, or NULL if it failed.
+ * @param size The requested size.
+ * @return ptr.
+ */
+static inline void *profile_note(void *ptr, size_t size) {
+    trace_op(MY_TRACE_MALLOC, ptr, NULL, size);
+    size_t rate = atomic_load_explicit(&profile_rate, memory_order_relaxed);
+    if (!rate || !ptr) return ptr;
+    if (size < sample_left) {
+        sample_left -= size;
+        return ptr;
+    }
+    sample_left = sample_interval(rate);
+    profile_sample(ptr, size);
+    return ptr;
+}
+
+/**
+ * @brief Drops a pointer that is being freed from the live samples.
+ *
+ * Only sampled pointers take the lock; the probe itself reads keys only.
+ *
+ * @param ptr The pointer being freed.
+ */
+static void profile_forget(void *ptr) {
+    size_t h = ((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < PROFILE_SLOTS; i++) {
+        ProfileSlot *sl = &profile_slots[(h + i) & (PROFILE_SLOTS - 1)];
+        uintptr_t key = atomic_load_explicit(&sl->key, memory_order_acquire);
+        if (!key) return;
+        if (key != (uintptr_t)ptr) continue;
+
+        pthread_mutex_lock(&profile_lock);
+        if (atomic_load_explicit(&sl->key, memory_order_relaxed) != key) {
+            pthread_mutex_unlock(&profile_lock);
+            return;
+        }
+        ProfileBucket *b = &profile_buckets[sl->bucket];
+        b->live_objs--;
+        b->live_bytes -= sl->size;
+        atomic_store_explicit(&sl->key, PROFILE_TOMBSTONE, memory_order_relaxed);
+        // With nothing live, the tombstones can go. A concurrent probe can
+        // only be for an unsampled pointer, which it will not find either way.
+        if (atomic_fetch_sub_explicit(&profile_live, 1, memory_order_relaxed) == 1) {
+            for (size_t j = 0; j < PROFILE_SLOTS; j++) {
+                atomic_store_explicit(&profile_slots[j].key, 0, memory_order_relaxed);
+            }
+        }
+        pthread_mutex_unlock(&profile_lock);
+        return;
+    }
+}
+
+/**
+ * @brief Starts or stops heap profile sampling.
+ *
+ * The tables are mapped on first use and kept, so sampled allocations made
+ * while sampling was on are still tracked after it is turned off.
+ *
+ * @param rate The mean bytes between samples, or 0 to stop.
+ * @return 1 on success, 0 if the tables could not be mapped.
+ */
+static int profile_set_rate(size_t rate) {
+    pthread_mutex_lock(&profile_lock);
+    if (rate && !profile_buckets) {
+        void *b = mmap(NULL, PROFILE_BUCKETS * sizeof(ProfileBucket), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void *sl = mmap(NULL, PROFILE_SLOTS * sizeof(ProfileSlot), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (b == MAP_FAILED || sl == MAP_FAILED) {
+            if (b != MAP_FAILED) munmap(b, PROFILE_BUCKETS * sizeof(ProfileBucket));
+            if (sl != MAP_FAILED) munmap(sl, PROFILE_SLOTS * sizeof(ProfileSlot));
+            pthread_mutex_unlock(&profile_lock);
+            return 0;
+        }
+        profile_buckets = b;
+        profile_slots = sl;
+    }
+    if (rate) profile_last_rate = rate;
+    pthread_mutex_unlock(&profile_lock);
+
+    // The first backtrace may load the unwinder, which allocates; do it now
+    // rather than in the middle of a sample.
+    if (rate) {
+        void *frame;
+        in_sample = 1;
+        backtrace(&frame, 1);
+        in_sample = 0;
+    }
+    atomic_store_explicit(&profile_rate, rate, memory_order_relaxed);
+    return 1;
+}
+
+/**
+ * @brief Carves a block from a node's bins.
+ * @param nd The node.
+ * @param size The aligned payload size.
+ * @param zeroed If not NULL, set as for central_malloc.
+ * @return A pointer to the payload, or NULL if out of memory.
+ */
+static void *node_malloc(Node *nd, size_t size, int *zeroed) {
+    Block *b = size > SLAB_MAX && size <= FAST_MAX ? fast_malloc(nd, size) : NULL;
+    if (b) {
+        if (zeroed) *zeroed = 0;
+        node_bytes(nd, load_head(b) & BLOCK_SIZE_MASK, 0);
+    } else {
+        pthread_mutex_lock(&nd->lock);
+        b = central_malloc(nd, size, zeroed);
+        if (b) node_bytes(nd, block_size(b), 0);
+        pthread_mutex_unlock(&nd->lock);
+    }
+    if (!b) return NULL; // Out of memory.
+
+    // Return a pointer to the payload.
+    return (char*)b + BLOCK_HEADER;
+}
+
+/**
+ * @brief Allocates memory without counting it towards the heap profile.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the allocated memory, or NULL if the allocation fails.
+ */
+static void *malloc_impl(size_t size) {
+    // Small request: serve it from the thread's own runs without locking.
+    if (size <= SLAB_MAX) return heap_malloc(size_to_class(size));
+    if (size >= atomic_load_explicit(&mmap_threshold, memory_order_relaxed)) {
+        return huge_alloc(ALIGN, size);
+    }
+
+    return node_malloc(thread_node(), align_up(size), NULL);
+}
+
+/**
+ * @brief Returns the usable size of an allocation without racing its neighbors.
+ *
+ * A block's head word is read under the node lock, since freeing the block
+ * before it updates its PREV_FREE bit.
+ *
+ * @param ptr An allocated pointer.
+ * @return The usable size.
+ */
+static size_t locked_usable_size(void *ptr) {
+    Chunk *ch = chunk_of(ptr);
+    if (!ch || run_of(ch, ptr)) return usable_size(ptr);
+    pthread_mutex_lock(&ch->node->lock);
+    size_t usable = usable_size(ptr);
+    pthread_mutex_unlock(&ch->node->lock);
+    return usable;
+}
+
+/**
+ * @brief Adds room for the redzone to a request in debug builds.
+ * @param size The requested size.
+ * @return The size to allocate.
+ */
+static size_t debug_pad(size_t size) {
+    if (!DEBUG) return size;
+    return size > SIZE_MAX - REDZONE ? SIZE_MAX : size + REDZONE;
+}
+
+/**
+ * @brief Fills a new allocation and its redzone in debug builds.
+ * @param p The memory, allocated for debug_pad(size) bytes, or NULL.
+ * @param size The requested size.
+ * @return p.
+ */
+static void *debug_arm(void *p, size_t size) {
+    if (!DEBUG || !p) return p;
+    size_t usable = locked_usable_size(p);
+    memset(p, ALLOC_BYTE, size);
+    memset((char*)p + size, REDZONE_BYTE, usable - sizeof(size_t) - size);
+    memcpy((char*)p + usable - sizeof(size_t), &size, sizeof(size_t));
+    return p;
+}
+
+/**
+ * @brief Checks the redzone of an allocation made by a debug build.
+ * @param ptr The memory.
+ * @return The size that was requested for it, or 0 if ptr is outside the heap.
+ */
+static size_t debug_size(void *ptr) {
+    unsigned char *p = ptr;
+    size_t usable = locked_usable_size(ptr), size;
+    if (!usable) return 0;
+    memcpy(&size, p + usable - sizeof(size_t), sizeof(size_t));
+    if (size > usable - REDZONE) corrupt("buffer overflow", ptr);
+    for (size_t i = size; i < usable - sizeof(size_t); i++) {
+        if (p[i] != REDZONE_BYTE) corrupt("buffer overflow", ptr);
+    }
+    return size;
+}
+
+/**
+ * @brief Allocates a block of memory of a given size.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the allocated memory, or NULL if the allocation fails.
+ */
+void *my_malloc(size_t size) {
+    return profile_note(debug_arm(malloc_impl(debug_pad(size)), size), size);
+}
+
+/**
+ * @brief Allocates node-backed memory without counting it towards the heap profile.
+ * @param size The number of bytes to allocate.
+ * @param node The NUMA node number.
+ * @return A pointer to the allocated memory, or NULL on failure.
+ */
+static void *onnode_impl(size_t size, int node) {
+    pthread_once(&nodes_once, nodes_init);
+    if (node < 0 || node >= num_nodes) return NULL;
+    Node *nd = &nodes[node];
+
+    if (size <= SLAB_MAX) {
+        int c = size_to_class(size);
+        pthread_mutex_lock(&nd->lock);
+        Run *r = nd->partial[c];
+        if (!r && (r = run_create(nd, c, NULL))) run_link(&nd->partial[c], r);
+        FreeObj *o = NULL;
+        if (r) {
+            o = r->free_list;
+            r->free_list = obj_next(o);
+            if (--r->nfree == 0) run_unlink(&nd->partial[c], r);
+            o->key = 0;
+        }
+        pthread_mutex_unlock(&nd->lock);
+        if (o) stat_class(c, 0);
+        return o;
+    }
+
+    if (size >= atomic_load_explicit(&mmap_threshold, memory_order_relaxed)) {
+        void *p = huge_alloc(ALIGN, size);
+        if (p) {
+            Huge *h = huge_of(p);
+            numa_bind(h, h->map_size, node);
+        }
+        return p;
+    }
+
+    return node_malloc(nd, align_up(size), NULL);
+}
+
+/**
+ * @brief Allocates memory backed by a given NUMA node.
+ *
+ * Small objects come from the node's orphan runs rather than the calling
+ * thread's heap, since that heap's runs live on the thread's own node.
+ *
+ * @param size The number of bytes to allocate.
+ * @param node The NUMA node number.
+ * @return A pointer to the allocated memory, or NULL if the allocation fails
+ *         or the node does not exist.
+ */
+void *my_malloc_onnode(size_t size, int node) {
+    return profile_note(debug_arm(onnode_impl(debug_pad(size), node), size), size);
+}
+
+/**
+ * @brief Frees memory, bypassing the quarantine of debug builds.
+ * @param ptr A pointer to the memory to free, not NULL.
+ */
+static void free_impl(void *ptr) {
+    // Check if the pointer belongs to one of the heap's chunks.
+    Chunk *ch = chunk_of(ptr);
+    if (!ch) {
+        // Huge allocations live in their own mappings.
+        Huge *h = huge_of(ptr);
+        if (h && huge_unregister(h)) {
+            stat_bytes(0, h->map_size - (size_t)((char*)ptr - (char*)h));
+            stat_mapped(0, h->map_size);
+            munmap(h, h->map_size);
+            return;
+        }
+        fprintf(stderr, "my_free: pointer %p is outside heap\n", ptr);
+        return;
+    }
+
+    Run *r = run_of(ch, ptr);
+    if (r) {
+        // Small object: check it is one the run handed out.
+        if (!slab_is_object(r, ptr)) {
+            fprintf(stderr, "my_free: pointer %p is not an allocated block\n", ptr);
+            return;
+        }
+        small_free_checked(r, ptr);
+        return;
+    }
+
+    // Get a pointer to the block header.
+    Block *b = (Block*)((char*)ptr - BLOCK_HEADER);
+
+    // Park mid-sized blocks in a fastbin without the node lock. A neighbor
+    // being freed may update the PREV_FREE bit at the same time, hence
+    // load_head; fast_free catches a double free of a fastbin block.
+    Node *nd = ch->node;
+    check_block(b);
+    size_t head = load_head(b);
+    size_t size = head & BLOCK_SIZE_MASK;
+    if (size > SLAB_MAX && size <= FAST_MAX && !(head & BLOCK_FREE)) {
+        if (!fast_free(nd, b, size)) {
+            fprintf(stderr, "my_free: double free or free of already free block %p\n", ptr);
+            return;
+        }
+        node_bytes(nd, 0, size);
+        return;
+    }
+
+    // Check for double-free under the lock, which merging blocks holds.
+    pthread_mutex_lock(&nd->lock);
+    if (block_is_free(b)) {
+        pthread_mutex_unlock(&nd->lock);
+        fprintf(stderr, "my_free: double free or free of already free block %p\n", ptr);
+        return;
+    }
+    // An overflow of the block shows in the header that follows it.
+    check_block(next_block(b));
+
+    // Mark the rest free and coalesce them with their neighbors, in the bins
+    // of the node the chunk belongs to.
+    node_bytes(nd, 0, size);
+    central_free(nd, b);
+    decay_tick(nd);
+    pthread_mutex_unlock(&nd->lock);
+}
+
+/**
+ * @brief Checks whether a pointer is a live allocation, for debug builds.
+ * @param ptr The pointer.
+ * @return 1 if ptr was handed out and not released since, 0 for anything
+ *         free_impl would reject.
+ */
+static int debug_owned(void *ptr) {
+    Chunk *ch = chunk_of(ptr);
+    if (!ch) return huge_of(ptr) != NULL;
+    Run *r = run_of(ch, ptr);
+    if (r) {
+        FreeObj *o = ptr;
+        return slab_is_object(r, ptr) && !(o->key == FREE_OBJ_KEY && slab_is_free(r, o));
+    }
+    Block *b = (Block*)((char*)ptr - BLOCK_HEADER);
+    pthread_mutex_lock(&ch->node->lock);
+    check_block(b);
+    int live = !block_is_free(b) && !fast_holds(b);
+    pthread_mutex_unlock(&ch->node->lock);
+    return live;
+}
+
+/**
+ * @brief Frees memory through the quarantine of debug builds.
+ *
+ * The redzone is checked and the memory filled with FREE_BYTE. It is only
+ * released once QUARANTINE_SLOTS later frees have pushed it out, after
+ * checking that nothing wrote to it in the meantime.
+ *
+ * @param ptr A pointer to the memory to free, not NULL.
+ */
+static void debug_free(void *ptr) {
+    if (!debug_owned(ptr)) {
+        free_impl(ptr); // Reports the bad pointer.
+        return;
+    }
+
+    // Filling an object that turns out to be quarantined already is harmless.
+    memset(ptr, FREE_BYTE, debug_size(ptr));
+    pthread_mutex_lock(&quarantine_lock);
+    for (int i = 0; i < QUARANTINE_SLOTS; i++) {
+        if (quarantine[i] == ptr) {
+            pthread_mutex_unlock(&quarantine_lock);
+            fprintf(stderr, "my_free: double free or free of already free block %p\n", ptr);
+            return;
+        }
+    }
+    void *old = quarantine[quarantine_next];
+    quarantine[quarantine_next] = ptr;
+    quarantine_next = (quarantine_next + 1) % QUARANTINE_SLOTS;
+    pthread_mutex_unlock(&quarantine_lock);
+    if (!old) return;
+
+    unsigned char *p = old;
+    size_t size = debug_size(old);
+    for (size_t i = 0; i < size; i++) {
+        if (p[i] != FREE_BYTE) corrupt("write after free", old);
+    }
+    free_impl(old);
+}
+
+/**
+ * @brief Frees a previously allocated block of memory.
+ * @param ptr A pointer to the memory to free.
+ */
+void my_free(void *ptr) {
+    if (!ptr) return;
+    trace_op(MY_TRACE_FREE, ptr, NULL, 0);
+    if (atomic_load_explicit(&profile_live, memory_order_acquire)) profile_forget(ptr);
+    if (DEBUG) debug_free(ptr);
+    else free_impl(ptr);
+}
+
+/**
+ * @brief Frees memory whose requested size the caller still knows.
+ *
+ * A small object's run is found by masking its address, so the chunk and
+ * run map lookups of my_free are skipped.
+ *
+ * @param ptr A pointer returned by my_malloc, my_calloc or my_realloc.
+ * @param size The size that was requested for ptr.
+ */
+void my_free_sized(void *ptr, size_t size) {
+    if (!ptr) return;
+    if (atomic_load_explicit(&profile_live, memory_order_acquire)) profile_forget(ptr);
+    if (DEBUG || size > SLAB_MAX) {
+        my_free(ptr);
+        return;
+    }
+    trace_op(MY_TRACE_FREE, ptr, NULL, 0);
+    small_free_checked((Run*)((uintptr_t)ptr & ~(uintptr_t)(RUN_SIZE - 1)), ptr);
+}
+
+/**
+ * @brief Returns the number of bytes usable at an allocated pointer.
+ *
+ * This is at least the requested size and includes any rounding up to a
+ * size class or alignment boundary.
+ *
+ * @param ptr A pointer returned by the allocator, or NULL.
+ * @return The usable size, or 0 for NULL or a pointer outside the heap.
+ */
+size_t my_malloc_usable_size(void *ptr) {
+    if (!ptr) return 0;
+    return DEBUG ? debug_size(ptr) : usable_size(ptr);
+}
+
+/**
+ * @brief Allocates a batch without counting it towards the heap profile.
+ * @param size The number of bytes to allocate for each object.
+ * @param n The number of objects.
+ * @param out Receives the object pointers.
+ * @return The number of objects allocated.
+ */
+static size_t batch_impl(size_t size, size_t n, void **out) {
+    size_t done = 0;
+
+    if (size <= SLAB_MAX) {
+        int c = size_to_class(size);
+        while (done < n && (out[done] = heap_malloc(c))) done++;
+        return done;
+    }
+
+    if (size >= atomic_load_explicit(&mmap_threshold, memory_order_relaxed)) {
+        while (done < n && (out[done] = huge_alloc(ALIGN, size))) done++;
+        return done;
+    }
+
+    // Carve in groups no larger than half a chunk, so a single batch never
+    // forces an oversized chunk.
+    size = align_up(size);
+    size_t group = (MAX_CHUNK_SIZE / 2) / (size + BLOCK_OVERHEAD);
+    if (!group) group = 1;
+    Node *nd = thread_node();
+    pthread_mutex_lock(&nd->lock);
+    while (done < n) {
+        size_t count = n - done < group ? n - done : group;
+        if (!central_malloc_batch(nd, size, count, out + done)) break;
+        done += count;
+    }
+    size_t bytes = 0;
+    for (size_t i = 0; i < done; i++) bytes += block_size((Block*)((char*)out[i] - BLOCK_HEADER));
+    stat_bytes(bytes, 0);
+    pthread_mutex_unlock(&nd->lock);
+    return done;
+}
+
+/**
+ * @brief Allocates many objects of the same size at once.
+ *
+ * Small objects are taken from the calling thread's own runs without any
+ * lock. Larger ones are carved as adjacent blocks from one free block.
+ *
+ * @param size The number of bytes to allocate for each object.
+ * @param n The number of objects.
+ * @param out Receives the object pointers.
+ * @return The number of objects allocated; less than n if out of memory.
+ */
+size_t my_malloc_batch(size_t size, size_t n, void **out) {
+    if (DEBUG) {
+        size_t done = 0;
+        while (done < n && (out[done] = my_malloc(size))) done++;
+        return done;
+    }
+    size_t done = batch_impl(size, n, out);
+    if (atomic_load_explicit(&profile_rate, memory_order_relaxed)
+        || atomic_load_explicit(&trace_on, memory_order_relaxed)) {
+        for (size_t i = 0; i < done; i++) profile_note(out[i], size);
+    }
+    return done;
+}
+
+/**
+ * @brief Orders pointers by address for qsort.
+ * @param a A pointer to the first pointer.
+ * @param b A pointer to the second pointer.
+ * @return A negative, zero or positive value like strcmp.
+ */
+static int compare_ptrs(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void *const *)a;
+    uintptr_t y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Frees many allocations at once.
+ *
+ * The pointers are sorted by address so that physically adjacent blocks are
+ * merged together and coalesced with their neighbors only once per run of
+ * blocks, and each node's lock is taken once per stretch of its blocks. Small
+ * objects go through the thread heaps first, since freeing them may itself
+ * need the lock.
+ *
+ * @param ptrs The pointers to free; the array is reordered. NULLs are skipped.
+ * @param n The number of pointers.
+ */
+void my_free_batch(void **ptrs, size_t n) {
+    if (DEBUG) {
+        // A my_heap_t's blocks have no redzones, so free them as my_heap_free does.
+        for (size_t i = 0; i < n; i++) {
+            Chunk *ch = ptrs[i] ? chunk_of(ptrs[i]) : NULL;
+            if (ch && ch->node->heap) free_impl(ptrs[i]);
+            else my_free(ptrs[i]);
+        }
+        return;
+    }
+    qsort(ptrs, n, sizeof(void*), compare_ptrs);
+
+    // Small objects, huge allocations and stray pointers take the ordinary path.
+    int profiled = atomic_load_explicit(&profile_live, memory_order_acquire) != 0;
+    for (size_t i = 0; i < n; i++) {
+        Chunk *ch = ptrs[i] ? chunk_of(ptrs[i]) : NULL;
+        if (ptrs[i] && (!ch || run_of(ch, ptrs[i]))) {
+            my_free(ptrs[i]);
+            ptrs[i] = NULL;
+        } else if (ptrs[i]) {
+            trace_op(MY_TRACE_FREE, ptrs[i], NULL, 0);
+            if (profiled) profile_forget(ptrs[i]);
+        }
+    }
+
+    Node *nd = NULL;
+    for (size_t i = 0; i < n; i++) {
+        void *ptr = ptrs[i];
+        if (!ptr) continue;
+
+        // Sorting keeps each chunk's blocks together, so locks change rarely.
+        Node *owner = chunk_of(ptr)->node;
+        if (owner != nd) {
+            if (nd) pthread_mutex_unlock(&nd->lock);
+            nd = owner;
+            pthread_mutex_lock(&nd->lock);
+        }
+
+        Block *b = (Block*)((char*)ptr - BLOCK_HEADER);
+        check_block(b);
+        if (block_is_free(b) || fast_holds(b)) {
+            fprintf(stderr, "my_free: double free or free of already free block %p\n", ptr);
+            continue;
+        }
+        check_block(next_block(b));
+
+        // Fold the following pointers into b while they are its physical
+        // successors, then coalesce the combined block once.
+        size_t bytes = block_size(b);
+        Block *next;
+        while (i + 1 < n && ptrs[i + 1] == (char*)(next = next_block(b)) + BLOCK_HEADER
+               && !block_is_free(next) && !fast_holds(next)) {
+            // Keep the absorbed header flagged to catch a later double free.
+            next->head |= BLOCK_FREE;
+            bytes += block_size(next);
+            set_head(b, block_size(b) + BLOCK_OVERHEAD + block_size(next), b->head & BLOCK_FLAGS);
+            i++;
+        }
+        node_bytes(nd, 0, bytes);
+        central_free(nd, b);
+        decay_tick(nd);
+    }
+    if (nd) pthread_mutex_unlock(&nd->lock);
+}
+
+/**
+ * @brief Clears memory for calloc.
+ *
+ * Large ranges are written with non-temporal stores where SSE2 is
+ * available, so that a big table does not flush the caches of everything
+ * else on its way to memory.
+ *
+ * @param p The memory, aligned to ALIGN.
+ * @param n The number of bytes.
+ */
+static void clear_memory(void *p, size_t n) {
+#ifdef __SSE2__
+    if (n >= STREAM_CLEAR_MIN) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i *v = p;
+        size_t i = 0;
+        for (; i + 4 <= n / sizeof(__m128i); i += 4) {
+            _mm_stream_si128(v + i, zero);
+            _mm_stream_si128(v + i + 1, zero);
+            _mm_stream_si128(v + i + 2, zero);
+            _mm_stream_si128(v + i + 3, zero);
+        }
+        // Order the streaming stores before the memory is handed out.
+        _mm_sfence();
+        memset(v + i, 0, n - i * sizeof(__m128i));
+        return;
+    }
+#endif
+    memset(p, 0, n);
+}
+
+/**
+ * @brief Allocates and zeros out a block of memory.
+ * @param n The number of elements to allocate.
+ * @param s The size of each element.
+ * @return A pointer to the allocated and zeroed memory, or NULL on failure,
+ *         including when n * s overflows.
+ */
+void *my_calloc(size_t n, size_t s) {
+    if (s && n > SIZE_MAX / s) return NULL;
+    size_t total = n * s;
+    if (DEBUG) {
+        void *p = my_malloc(total);
+        if (p) memset(p, 0, total);
+        return p;
+    }
+    // Huge mappings are fresh from the kernel and need no clearing.
+    if (total >= atomic_load_explicit(&mmap_threshold, memory_order_relaxed)) {
+        return profile_note(huge_alloc(ALIGN, total), total);
+    }
+    if (total <= SLAB_MAX) {
+        void *p = my_malloc(total);
+        if (p) memset(p, 0, total);
+        return p;
+    }
+
+    // Heap blocks only need the bytes outside their purged pages cleared.
+    int zeroed;
+    char *p = node_malloc(thread_node(), align_up(total), &zeroed);
+    if (!p) return NULL;
+    char *lo, *hi;
+    if (zeroed && purge_range((Block*)(p - BLOCK_HEADER), &lo, &hi) && lo < p + total) {
+        memset(p, 0, (size_t)(lo - p));
+        if (hi < p + total) memset(hi, 0, (size_t)(p + total - hi));
+    } else {
+        clear_memory(p, total);
+    }
+    return profile_note(p, total);
+}
+
+/**
+ * @brief Resizes a previously allocated block of memory.
+ * @param ptr A pointer to the memory to resize.
+ * @param size The new size of the memory block.
+ * @return A pointer to the resized memory block, or NULL on failure.
+ */
+static void *realloc_impl(void *ptr, size_t size) {
+    if (!ptr) return my_malloc(size);
+    Chunk *ch = chunk_of(ptr);
+    Huge *h = ch ? NULL : huge_of(ptr);
+    if (!ch && !h) {
+        fprintf(stderr, "my_realloc: pointer %p is outside heap\n", ptr);
+        return NULL;
+    }
+    // Debug builds always move, so that stale pointers land in the quarantine.
+    if (DEBUG) {
+        size_t old = debug_size(ptr);
+        void *newp = my_malloc(size);
+        if (!newp) return NULL;
+        memcpy(newp, ptr, old < size ? old : size);
+        my_free(ptr);
+        return newp;
+    }
+
+    Run *r = ch ? run_of(ch, ptr) : NULL;
+    // Loaded once, so that the cases below agree on it while my_mallopt changes it.
+    size_t threshold = atomic_load_explicit(&mmap_threshold, memory_order_relaxed);
+
+    if (h) {
+        // Huge allocations that stay huge are remapped instead of copied.
+        // A mapping that moves counts as a new allocation for the profile.
+        if (size >= threshold) {
+            void *newp = huge_realloc(h, ptr, size);
+            if (newp && newp != ptr) {
+                if (atomic_load_explicit(&profile_live, memory_order_acquire)) profile_forget(ptr);
+                profile_note(newp, size);
+            }
+            return newp;
+        }
+    } else if (r) {
+        // Small objects keep their slot while the size maps to the same class,
+        // so my_free_sized can always derive the class from the size.
+        if (size <= SLAB_MAX && size_to_class(size) == r->class_idx) return ptr;
+    } else if (size > SLAB_MAX && size < threshold) {
+        // Blocks grow into a free neighbor or shrink by releasing their tail.
+        Block *b = (Block*)((char*)ptr - BLOCK_HEADER);
+        pthread_mutex_lock(&ch->node->lock);
+        size_t old = block_size(b);
+        int done = resize_block(ch->node, b, align_up(size));
+        if (done) stat_bytes(block_size(b), old);
+        pthread_mutex_unlock(&ch->node->lock);
+        if (done) return ptr;
+    }
+
+    // Allocate a new block, copy the data, and free the old block.
+    size_t old = usable_size(ptr);
+    if (old > size) old = size;
+    void *newp = my_malloc(size);
+    if (!newp) return NULL;
+    memcpy(newp, ptr, old);
+    my_free(ptr);
+    return newp;
+}
+
+/**
+ * @brief Resizes a previously allocated block of memory.
+ *
+ * The allocations and frees a move makes are traced as one realloc.
+ *
+ * @param ptr A pointer to the memory to resize.
+ * @param size The new size of the memory block.
+ * @return A pointer to the resized memory block, or NULL on failure.
+ */
+void *my_realloc(void *ptr, size_t size) {
+    if (!atomic_load_explicit(&trace_on, memory_order_relaxed)) return realloc_impl(ptr, size);
+    in_realloc++;
+    void *newp = realloc_impl(ptr, size);
+    in_realloc--;
+    trace_op(MY_TRACE_REALLOC, newp, ptr, size);
+    return newp;
+}
+
+/**
+ * @brief Allocates aligned memory without counting it towards the heap profile.
+ * @param alignment The alignment, a power of two.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the aligned memory, or NULL on failure.
+ */
+static void *aligned_impl(size_t alignment, size_t size) {
+    if (!alignment || (alignment & (alignment - 1))) return NULL;
+    if (alignment <= ALIGN) return malloc_impl(size);
+    // Alignments this large would also overflow the heap search, which asks
+    // for twice the alignment in slack.
+    size_t threshold = atomic_load_explicit(&mmap_threshold, memory_order_relaxed);
+    if (size >= threshold || alignment >= threshold) return huge_alloc(alignment, size);
+
+    // Objects of a class whose size is a multiple of the alignment are all
+    // aligned, since runs are page-aligned and their objects start at
+    // RUN_HEADER_SIZE.
+    if (size <= SLAB_MAX && alignment <= RUN_HEADER_SIZE) {
+        int c = size_to_class(size);
+        while (c < NUM_CLASSES && class_size[c] % alignment) c++;
+        if (c < NUM_CLASSES) return heap_malloc(c);
+    }
+
+    // Anything else is a block whose leading padding is split off and freed.
+    Node *nd = thread_node();
+    pthread_mutex_lock(&nd->lock);
+    Block *b = central_memalign(nd, alignment, align_up(size));
+    if (b) stat_bytes(block_size(b), 0);
+    pthread_mutex_unlock(&nd->lock);
+    if (!b) return NULL; // Out of memory.
+    return (char*)b + BLOCK_HEADER;
+}
+
+/**
+ * @brief Allocates memory aligned to a given boundary.
+ * @param alignment The alignment, a power of two.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the aligned memory, or NULL on failure.
+ */
+void *my_aligned_alloc(size_t alignment, size_t size) {
+    return profile_note(debug_arm(aligned_impl(alignment, debug_pad(size)), size), size);
+}
+
+/**
+ * @brief Allocates memory aligned to a given boundary.
+ * @param alignment The alignment, a power of two.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the aligned memory, or NULL on failure.
+ */
+void *my_memalign(size_t alignment, size_t size) {
+    return my_aligned_alloc(alignment, size);
+}
+
+/**
+ * @brief Allocates aligned memory, POSIX style.
+ * @param memptr Receives the pointer to the aligned memory.
+ * @param alignment The alignment, a power of two multiple of sizeof(void *).
+ * @param size The number of bytes to allocate.
+ * @return 0 on success, EINVAL for a bad alignment, ENOMEM if out of memory.
+ */
+int my_posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (!alignment || (alignment & (alignment - 1)) || alignment % sizeof(void*)) return EINVAL;
+    void *p = my_aligned_alloc(alignment, size);
+    if (!p) return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+/**
+ * @brief Allocates memory that shares no cache line with any other allocation.
+ *
+ * The request is rounded up to whole cache lines and aligned to one. Small
+ * requests come from the size classes that are multiples of a line, whose
+ * objects all start on a line boundary.
+ *
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the allocated memory, or NULL on failure.
+ */
+void *my_malloc_isolated(size_t size) {
+    if (size > SIZE_MAX - CACHE_LINE) return NULL;
+    size_t lines = size ? (size + CACHE_LINE - 1) / CACHE_LINE : 1;
+    return my_aligned_alloc(CACHE_LINE, lines * CACHE_LINE);
+}
+
+/**
+ * @brief Allocates a new chunk for an arena.
+ * @param size The capacity of the chunk.
+ * @return The chunk, or NULL if out of memory.
+ */
+static ArenaChunk *arena_chunk_new(size_t size) {
+    if (size > SIZE_MAX - sizeof(ArenaChunk)) return NULL;
+    ArenaChunk *ch = my_malloc(sizeof(ArenaChunk) + size);
+    if (!ch) return NULL; // Out of memory.
+    ch->size = size;
+    return ch;
+}
+
+/**
+ * @brief Makes a chunk the one an arena bumps through.
+ * @param a The arena.
+ * @param ch The chunk.
+ */
+static void arena_use_chunk(my_arena_t *a, ArenaChunk *ch) {
+    a->ptr = (char*)(ch + 1);
+    a->end = a->ptr + ch->size;
+}
+
+/**
+ * @brief Serves an arena allocation that does not fit in the current chunk.
+ *
+ * Requests larger than a quarter of the next chunk get a chunk of their own,
+ * linked behind the current one so that its free space is not abandoned.
+ * Otherwise a new chunk is started and the chunk size doubles.
+ *
+ * @param a The arena.
+ * @param size The aligned size.
+ * @return The allocated memory, or NULL if out of memory.
+ */
+static void *arena_alloc_slow(my_arena_t *a, size_t size) {
+    if (size > a->next_size / 4) {
+        ArenaChunk *ch = arena_chunk_new(size);
+        if (!ch) return NULL; // Out of memory.
+        ch->next = a->chunks->next;
+        a->chunks->next = ch;
+        return ch + 1;
+    }
+
+    ArenaChunk *ch = arena_chunk_new(a->next_size);
+    if (!ch) return NULL; // Out of memory.
+    ch->next = a->chunks;
+    a->chunks = ch;
+    arena_use_chunk(a, ch);
+    if (a->next_size < ARENA_MAX_CHUNK) a->next_size *= 2;
+
+    void *p = a->ptr;
+    a->ptr += size;
+    return p;
+}
+
+/**
+ * @brief Creates an arena.
+ * @param initial The capacity of the first chunk; 0 picks a default.
+ * @return The arena, or NULL if out of memory.
+ */
+my_arena_t *my_arena_create(size_t initial) {
+    my_arena_t *a = my_malloc(sizeof(my_arena_t));
+    if (!a) return NULL; // Out of memory.
+    initial = initial < ARENA_MIN_CHUNK ? ARENA_MIN_CHUNK : align_up(initial);
+
+    ArenaChunk *ch = arena_chunk_new(initial);
+    if (!ch) {
+        my_free(a);
+        return NULL; // Out of memory.
+    }
+    ch->next = NULL;
+    a->chunks = ch;
+    arena_use_chunk(a, ch);
+    a->next_size = initial < ARENA_MAX_CHUNK ? initial * 2 : initial;
+    return a;
+}
+
+/**
+ * @brief Allocates memory from an arena.
+ * @param a The arena.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the memory, or NULL if out of memory.
+ */
+void *my_arena_alloc(my_arena_t *a, size_t size) {
+    if (size > SIZE_MAX - ALIGN) return NULL;
+    size = align_up(size ? size : 1);
+    if (size <= (size_t)(a->end - a->ptr)) {
+        void *p = a->ptr;
+        a->ptr += size;
+        return p;
+    }
+    return arena_alloc_slow(a, size);
+}
+
+/**
+ * @brief Releases every allocation of an arena at once.
+ *
+ * The chunk being bumped, which is also the largest regular one, is kept for
+ * the next round of allocations; all other chunks go back to the heap.
+ *
+ * @param a The arena.
+ */
+void my_arena_reset(my_arena_t *a) {
+    ArenaChunk *keep = a->chunks;
+    ArenaChunk *ch = keep->next;
+    while (ch) {
+        ArenaChunk *next = ch->next;
+        my_free(ch);
+        ch = next;
+    }
+    keep->next = NULL;
+    arena_use_chunk(a, keep);
+}
+
+/**
+ * @brief Destroys an arena and releases all of its memory.
+ * @param a The arena, or NULL.
+ */
+void my_arena_destroy(my_arena_t *a) {
+    if (!a) return;
+    ArenaChunk *ch = a->chunks;
+    while (ch) {
+        ArenaChunk *next = ch->next;
+        my_free(ch);
+        ch = next;
+    }
+    my_free(a);
+}
+
+/**
+ * @brief Creates an independent heap.
+ *
+ * The heap's memory is bound to the calling thread's NUMA node, and its
+ * first chunk is mapped right away.
+ *
+ * @param size The capacity of its first chunk in bytes; 0 picks a default.
+ * @return The heap, or NULL if out of memory or size is too large.
+ */
+my_heap_t *my_heap_create(size_t size) {
+    if (size > MAX_HEAP_CHUNK) return NULL;
+    Node *home = thread_node();
+    my_heap_t *h = my_aligned_alloc(_Alignof(my_heap_t), sizeof(my_heap_t));
+    if (!h) return NULL; // Out of memory.
+    memset(h, 0, sizeof(*h));
+    node_init(&h->node, home->id, size ? first_chunk_size(size) : CHUNK_SIZE);
+    h->node.heap = h;
+    if (!heap_grow(&h->node, 0)) {
+        my_free(h);
+        return NULL; // Out of memory.
+    }
+
+    pthread_mutex_lock(&heaps_lock);
+    h->next = live_heaps;
+    if (live_heaps) live_heaps->prev = h;
+    live_heaps = h;
+    pthread_mutex_unlock(&heaps_lock);
+    return h;
+}
+
+/**
+ * @brief Allocates memory from a heap.
+ *
+ * Every size, however small, is carved from the heap's own chunks, which
+ * grow as needed. A heap has no mappings of its own, so sizes the bins
+ * cannot hold are refused.
+ *
+ * @param h The heap.
+ * @param size The number of bytes to allocate.
+ * @return A pointer to the memory, or NULL if out of memory or size exceeds
+ *         MAX_BIN_REQUEST.
+ */
+void *my_heap_malloc(my_heap_t *h, size_t size) {
+    if (size > MAX_BIN_REQUEST) return NULL;
+    return node_malloc(&h->node, align_up(size ? size : 1), NULL);
+}
+
+/**
+ * @brief Frees memory allocated from a heap.
+ * @param h The heap.
+ * @param ptr A pointer returned by my_heap_malloc on h, or NULL.
+ */
+void my_heap_free(my_heap_t *h, void *ptr) {
+    if (!ptr) return;
+    Chunk *ch = chunk_of(ptr);
+    if (!ch || ch->node != &h->node) {
+        fprintf(stderr, "my_heap_free: pointer %p is not from heap %p\n", ptr, (void*)h);
+        return;
+    }
+    free_impl(ptr);
+}
+
+/**
+ * @brief Returns the number of bytes allocated from a heap and not yet freed.
+ * @param h The heap.
+ * @return The usable bytes of its live allocations.
+ */
+size_t my_heap_allocated(const my_heap_t *h) {
+    return atomic_load_explicit(&h->allocated, memory_order_relaxed);
+}
+
+/**
+ * @brief Destroys a heap and unmaps all of its memory at once.
+ *
+ * Only the chunks are visited, not the blocks in them, so the cost does
+ * not depend on how many allocations are still live.
+ *
+ * @param h The heap, or NULL.
+ */
+void my_heap_destroy(my_heap_t *h) {
+    if (!h) return;
+    pthread_mutex_lock(&heaps_lock);
+    if (h->prev) h->prev->next = h->next;
+    else live_heaps = h->next;
+    if (h->next) h->next->prev = h->prev;
+    pthread_mutex_unlock(&heaps_lock);
+
+    Chunk *ch = h->node.first_chunk;
+    while (ch) {
+        Chunk *next = ch->next;
+        chunk_map_unregister(ch);
+        stat_mapped(0, ch->size);
+        munmap(ch, ch->size);
+        ch = next;
+    }
+    pthread_mutex_destroy(&h->node.lock);
+    for (int j = 0; j < FAST_BINS; j++) pthread_spin_destroy(&h->node.fast[j].lock);
+    my_free(h);
+}
+
+/**
+ * @brief Adjusts a tunable parameter of the allocator.
+ * @param param The parameter to change, e.g. MY_M_MMAP_THRESHOLD.
+ * @param value The new value.
+ * @return 1 on success, 0 if the parameter or value is invalid.
+ */
+int my_mallopt(int param, size_t value) {
+    switch (param) {
+    case MY_M_MMAP_THRESHOLD:
+        // Small requests always come from the slab runs, and ones the bins
+        // cannot hold always get a mapping.
+        if (value <= SLAB_MAX) return 0;
+        if (value > MAX_BIN_REQUEST) value = MAX_BIN_REQUEST;
+        atomic_store_explicit(&mmap_threshold, value, memory_order_relaxed);
+        return 1;
+    case MY_M_PROFILE_RATE:
+        return profile_set_rate(value);
+    case MY_M_DECAY_MS:
+        atomic_store_explicit(&decay_ms, value, memory_order_relaxed);
+        return 1;
+    case MY_M_HEAP_SIZE: {
+        if (value > MAX_HEAP_CHUNK) return 0;
+        pthread_once(&nodes_once, nodes_init);
+        for (int i = 0; i < MAX_NODES; i++) {
+            pthread_mutex_lock(&nodes[i].lock);
+            if (!nodes[i].first_chunk) nodes[i].next_chunk_size = first_chunk_size(value);
+            pthread_mutex_unlock(&nodes[i].lock);
+        }
+        // Map the calling thread's chunk now rather than on its first request.
+        Node *nd = thread_node();
+        pthread_mutex_lock(&nd->lock);
+        int ok = nd->first_chunk || heap_grow(nd, 0);
+        pthread_mutex_unlock(&nd->lock);
+        return ok;
+    }
+    case MY_M_POPULATE:
+        atomic_store_explicit(&map_populate, value != 0, memory_order_relaxed);
+        return 1;
+    case MY_M_HUGEPAGES:
+        if (value > MY_HUGEPAGES_EXPLICIT) return 0;
+        atomic_store_explicit(&map_hugepages, (int)value, memory_order_relaxed);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Merges the blocks waiting in every node's fastbins into the bins.
+ */
+void my_malloc_consolidate(void) {
+    pthread_once(&nodes_once, nodes_init);
+    for (int i = 0; i < num_nodes; i++) {
+        pthread_mutex_lock(&nodes[i].lock);
+        consolidate(&nodes[i]);
+        pthread_mutex_unlock(&nodes[i].lock);
+    }
+}
+
+/**
+ * @brief Runs a decay pass on every node now instead of at its next free.
+ */
+void my_malloc_decay(void) {
+    pthread_once(&nodes_once, nodes_init);
+    for (int i = 0; i < num_nodes; i++) {
+        pthread_mutex_lock(&nodes[i].lock);
+        decay(&nodes[i]);
+        pthread_mutex_unlock(&nodes[i].lock);
+    }
+}
+
+/**
+ * @brief Adds one set of thread counters into a snapshot.
+ * @param st The snapshot.
+ * @param ts The counters.
+ * @param alloc Accumulates the bytes allocated.
+ * @param freed Accumulates the bytes freed.
+ */
+static void stats_merge(struct my_stats *st, ThreadStats *ts, size_t *alloc, size_t *freed) {
+    *alloc += atomic_load_explicit(&ts->alloc_bytes, memory_order_relaxed);
+    *freed += atomic_load_explicit(&ts->free_bytes, memory_order_relaxed);
+    for (int fl = 0; fl < FL_COUNT; fl++) {
+        st->bins[fl].mallocs += atomic_load_explicit(&ts->bin[fl][STAT_MALLOC], memory_order_relaxed);
+        st->bins[fl].frees += atomic_load_explicit(&ts->bin[fl][STAT_FREE], memory_order_relaxed);
+        st->bins[fl].splits += atomic_load_explicit(&ts->bin[fl][STAT_SPLIT], memory_order_relaxed);
+        st->bins[fl].coalesces += atomic_load_explicit(&ts->bin[fl][STAT_COALESCE], memory_order_relaxed);
+    }
+    for (int c = 0; c < NUM_CLASSES; c++) {
+        st->classes[c].mallocs += atomic_load_explicit(&ts->class_malloc[c], memory_order_relaxed);
+        st->classes[c].frees += atomic_load_explicit(&ts->class_free[c], memory_order_relaxed);
+    }
+    for (int i = 0; i < MY_STATS_PROBE_BUCKETS; i++) {
+        st->probes[i] += atomic_load_explicit(&ts->probes[i], memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Fills in a snapshot of the allocator's statistics.
+ *
+ * The counters of every thread heap are summed, then each node's chunks are
+ * walked under its lock to measure free space and overhead.
+ *
+ * @param st Receives the statistics.
+ */
+void my_malloc_stats(struct my_stats *st) {
+    memset(st, 0, sizeof(*st));
+    size_t alloc = 0, freed = 0;
+    pthread_mutex_lock(&stats_lock);
+    for (ThreadHeap *h = all_heaps; h; h = h->next_all) stats_merge(st, &h->stats, &alloc, &freed);
+    pthread_mutex_unlock(&stats_lock);
+    stats_merge(st, &shared_stats, &alloc, &freed);
+    // Threads update their counters independently, so the frees may be seen
+    // before the matching allocations.
+    st->allocated = alloc > freed ? alloc - freed : 0;
+    for (int c = 0; c < NUM_CLASSES; c++) st->classes[c].size = class_size[c];
+
+    pthread_once(&nodes_once, nodes_init);
+    for (int i = 0; i < num_nodes; i++) {
+        Node *nd = &nodes[i];
+        pthread_mutex_lock(&nd->lock);
+        for (Chunk *ch = nd->first_chunk; ch; ch = ch->next) {
+            st->overhead += chunk_header_size(ch->size) + BLOCK_HEADER;
+            for (Block *b = ch->first; b != ch->sentinel; b = next_block(b)) {
+                st->overhead += BLOCK_OVERHEAD;
+                if (!block_is_free(b)) continue;
+                st->free += block_size(b);
+                if (block_size(b) > st->largest_free) st->largest_free = block_size(b);
+                char *lo, *hi;
+                if ((b->head & BLOCK_PURGED) && purge_range(b, &lo, &hi)) st->purged += (size_t)(hi - lo);
+            }
+        }
+        // Fastbin blocks look allocated to the walk; count them from the lists.
+        for (int j = 0; j < FAST_BINS; j++) {
+            FastBin *fb = &nd->fast[j];
+            pthread_spin_lock(&fb->lock);
+            Block *b = atomic_load_explicit(&fb->first, memory_order_relaxed);
+            for (; b; b = load_link(&b->next_free)) {
+                st->free += block_size(b);
+                if (block_size(b) > st->largest_free) st->largest_free = block_size(b);
+            }
+            pthread_spin_unlock(&fb->lock);
+        }
+        pthread_mutex_unlock(&nd->lock);
+    }
+
+    st->mapped = atomic_load_explicit(&mapped_bytes, memory_order_relaxed);
+    st->peak_mapped = atomic_load_explicit(&peak_mapped_bytes, memory_order_relaxed);
+    st->fragmentation = st->free ? 1.0 - (double)st->largest_free / (double)st->free : 0.0;
+}
+
+/**
+ * @brief Visits every block of one node in physical order.
+ *
+ * Fastbin blocks are told apart by their BLOCK_FAST bit, so the fastbin
+ * locks are not needed. A blocking walk drops and retakes the node's lock
+ * between chunks so that a long walk only delays other threads by one chunk
+ * at a time; chunks are never unmapped, so it can continue from where it
+ * left off. A trying walk holds the lock for the whole node instead, and
+ * gives up on the node if the lock is busy.
+ *
+ * @param nd The node.
+ * @param fn The callback.
+ * @param arg Passed to the callback.
+ * @param try_only If non-zero, only try to take the lock.
+ * @return 1 if the node was walked, 0 if its lock was busy.
+ */
+static int walk_node(Node *nd, my_heap_walker fn, void *arg, int try_only) {
+    if (try_only) {
+        if (pthread_mutex_trylock(&nd->lock) != 0) return 0;
+    } else {
+        pthread_mutex_lock(&nd->lock);
+    }
+    for (Chunk *ch = nd->first_chunk; ch; ch = ch->next) {
+        struct my_block_info info = { .node = nd->id, .chunk = ch };
+        for (Block *b = ch->first; b != ch->sentinel; b = next_block(b)) {
+            char *payload = (char*)b + BLOCK_HEADER;
+            size_t head = load_head(b);
+            info.offset = (size_t)((char*)b - (char*)ch);
+            info.size = head & BLOCK_SIZE_MASK;
+            info.bin = -1;
+            info.size_class = -1;
+            if (head & BLOCK_FREE) {
+                int fl, sl;
+                size_to_bin(info.size, &fl, &sl);
+                info.state = MY_BLOCK_FREE;
+                info.bin = fl;
+            } else if (head & BLOCK_FAST) {
+                info.state = MY_BLOCK_FAST;
+            } else if ((uintptr_t)payload % RUN_SIZE == 0 && run_of(ch, payload)) {
+                info.state = MY_BLOCK_RUN;
+                info.size_class = ((Run*)payload)->class_idx;
+            } else {
+                info.state = MY_BLOCK_USED;
+            }
+            fn(&info, arg);
+        }
+        if (!try_only) {
+            pthread_mutex_unlock(&nd->lock);
+            pthread_mutex_lock(&nd->lock);
+        }
+    }
+    pthread_mutex_unlock(&nd->lock);
+    return 1;
+}
+
+/**
+ * @brief Visits every block of the heap in physical order.
+ * @param fn The callback.
+ * @param arg Passed to the callback.
+ */
+void my_heap_walk(my_heap_walker fn, void *arg) {
+    pthread_once(&nodes_once, nodes_init);
+    for (int i = 0; i < num_nodes; i++) walk_node(&nodes[i], fn, arg, 0);
+}
+
+/**
+ * @brief The state of a JSON dump in progress.
+ *
+ * The output goes either to a stream or, for my_dump_json_fd, through a
+ * caller's buffer to a file descriptor, and is formatted without stdio so
+ * that the latter stays async-signal-safe.
+ */
+typedef struct JsonDump {
+    FILE *out;                   ///< The stream being written, or NULL.
+    int fd;                      ///< The file descriptor being written if out is NULL.
+    char *buf;                   ///< Buffers the output to fd.
+    size_t cap;                  ///< The size of buf.
+    size_t len;                  ///< The bytes waiting in buf.
+    int failed;                  ///< Set once a write fails.
+    size_t blocks;               ///< The number of blocks written so far.
+    size_t count[64];            ///< Free blocks by floor(log2(size)).
+    size_t bytes[64];            ///< Free bytes by floor(log2(size)).
+    size_t free;                 ///< All free bytes.
+    size_t largest;              ///< The largest free block.
+} JsonDump;
+
+/**
+ * @brief Writes out the bytes buffered for a file descriptor.
+ * @param d The dump.
+ */
+static void json_flush(JsonDump *d) {
+    size_t done = 0;
+    while (done < d->len && !d->failed) {
+        ssize_t n = write(d->fd, d->buf + done, d->len - done);
+        if (n > 0) done += (size_t)n;
+        else if (n < 0 && errno == EINTR) continue;
+        else d->failed = 1;
+    }
+    d->len = 0;
+}
+
+/**
+ * @brief Appends bytes to a JSON dump.
+ * @param d The dump.
+ * @param s The bytes.
+ * @param n Their number.
+ */
+static void json_write(JsonDump *d, const char *s, size_t n) {
+    if (d->out) {
+        fwrite(s, 1, n, d->out);
+        return;
+    }
+    while (n) {
+        if (d->len == d->cap) json_flush(d);
+        size_t k = d->cap - d->len < n ? d->cap - d->len : n;
+        memcpy(d->buf + d->len, s, k);
+        d->len += k;
+        s += k;
+        n -= k;
+    }
+}
+
+/**
+ * @brief Appends a string to a JSON dump.
+ * @param d The dump.
+ * @param s The string.
+ */
+static void json_str(JsonDump *d, const char *s) {
+    json_write(d, s, strlen(s));
+}
+
+/**
+ * @brief Appends a number to a JSON dump.
+ * @param d The dump.
+ * @param v The number.
+ * @param base 10, or 16 for an address, which gets a 0x prefix.
+ * @param width The least number of digits, padded with zeros.
+ */
+static void json_num(JsonDump *d, uintptr_t v, unsigned base, int width) {
+    char digits[2 + 2 * sizeof(v) * 3], *p = digits + sizeof(digits);
+    int n = 0;
+    do {
+        *--p = "0123456789abcdef"[v % base];
+        v /= base;
+        n++;
+    } while (v || n < width);
+    if (base == 16) {
+        *--p = 'x';
+        *--p = '0';
+    }
+    json_write(d, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+/**
+ * @brief Writes one block of a JSON dump and adds it to the histogram.
+ * @param info The block.
+ * @param arg The JsonDump.
+ */
+static void json_block(const struct my_block_info *info, void *arg) {
+    static const char *const states[] = { "used", "free", "run", "fast" };
+    JsonDump *d = arg;
+    json_str(d, d->blocks++ ? ",\n    {\"node\":" : "\n    {\"node\":");
+    json_num(d, (uintptr_t)info->node, 10, 1);
+    json_str(d, ",\"chunk\":\"");
+    json_num(d, (uintptr_t)info->chunk, 16, 1);
+    json_str(d, "\",\"offset\":");
+    json_num(d, info->offset, 10, 1);
+    json_str(d, ",\"size\":");
+    json_num(d, info->size, 10, 1);
+    json_str(d, ",\"state\":\"");
+    json_str(d, states[info->state]);
+    json_str(d, "\"");
+    if (info->bin >= 0) {
+        json_str(d, ",\"bin\":");
+        json_num(d, (uintptr_t)info->bin, 10, 1);
+    }
+    if (info->size_class >= 0) {
+        json_str(d, ",\"class\":");
+        json_num(d, (uintptr_t)info->size_class, 10, 1);
+    }
+    json_str(d, "}");
+
+    if ((info->state != MY_BLOCK_FREE && info->state != MY_BLOCK_FAST) || !info->size) return;
+    int bucket = 63 - __builtin_clzll((unsigned long long)info->size);
+    d->count[bucket]++;
+    d->bytes[bucket] += info->size;
+    d->free += info->size;
+    if (info->size > d->largest) d->largest = info->size;
+}
+
+/**
+ * @brief Walks the heap into a JSON dump and writes the histogram and totals.
+ * @param d The dump, with its output set up.
+ * @param try_only If non-zero, skip the nodes whose lock is busy.
+ * @return The number of nodes skipped.
+ */
+static int json_dump(JsonDump *d, int try_only) {
+    int skipped = 0;
+    json_str(d, "{\n  \"blocks\": [");
+    for (int i = 0; i < num_nodes; i++) {
+        if (!walk_node(&nodes[i], json_block, d, try_only)) skipped++;
+    }
+    json_str(d, "\n  ],\n  \"histogram\": [");
+    int first = 1;
+    for (int i = 0; i < 64; i++) {
+        if (!d->count[i]) continue;
+        json_str(d, first ? "\n    {\"min_size\":" : ",\n    {\"min_size\":");
+        json_num(d, (uintptr_t)1 << i, 10, 1);
+        json_str(d, ",\"count\":");
+        json_num(d, d->count[i], 10, 1);
+        json_str(d, ",\"bytes\":");
+        json_num(d, d->bytes[i], 10, 1);
+        json_str(d, "}");
+        first = 0;
+    }
+    // The fragmentation is written with four decimals, rounded.
+    double frag = d->free ? 1.0 - (double)d->largest / (double)d->free : 0.0;
+    uintptr_t frag4 = (uintptr_t)(frag * 10000.0 + 0.5);
+    json_str(d, "\n  ],\n  \"skipped_nodes\": ");
+    json_num(d, (uintptr_t)skipped, 10, 1);
+    json_str(d, ",\n  \"free\": ");
+    json_num(d, d->free, 10, 1);
+    json_str(d, ",\n  \"largest_free\": ");
+    json_num(d, d->largest, 10, 1);
+    json_str(d, ",\n  \"fragmentation\": ");
+    json_num(d, frag4 / 10000, 10, 1);
+    json_str(d, ".");
+    json_num(d, frag4 % 10000, 10, 4);
+    json_str(d, "\n}\n");
+    return skipped;
+}
+
+/**
+ * @brief Writes the physical heap layout as JSON.
+ * @param out The stream to write to.
+ */
+void my_dump_json(FILE *out) {
+    pthread_once(&nodes_once, nodes_init);
+    JsonDump d;
+    memset(&d, 0, sizeof(d));
+    d.out = out;
+    json_dump(&d, 0);
+}
+
+/**
+ * @brief Writes the physical heap layout as JSON from a signal handler.
+ *
+ * Nothing here allocates, takes a lock it could wait on or uses stdio: the
+ * node locks are only tried, and the output is formatted into the caller's
+ * buffer and written with write(2). Before the first allocation there is
+ * nothing to walk, so the nodes are not set up either.
+ *
+ * @param fd The file descriptor to write to.
+ * @param buf A buffer for the output.
+ * @param len The size of buf, at least 1.
+ * @return 1 if the whole heap was written, 0 if a node was busy or a write
+ *         failed.
+ */
+int my_dump_json_fd(int fd, char *buf, size_t len) {
+    if (!buf || !len) return 0;
+    int saved = errno;
+    JsonDump d;
+    memset(&d, 0, sizeof(d));
+    d.fd = fd;
+    d.buf = buf;
+    d.cap = len;
+    int skipped = json_dump(&d, 1);
+    json_flush(&d);
+    errno = saved;
+    return !skipped && !d.failed;
+}
+
+/**
+ * @brief Writes the sampled heap profile in the pprof legacy heap format.
+ *
+ * The heap_v2 header carries the sampling rate, from which pprof scales the
+ * sampled counts back up to estimates for the whole heap.
+ *
+ * @param out The stream to write to.
+ */
+void my_heap_profile_dump(FILE *out) {
+    pthread_mutex_lock(&profile_lock);
+    size_t live_objs = 0, live_bytes = 0, total_objs = 0, total_bytes = 0;
+    for (size_t i = 0; profile_buckets && i < PROFILE_BUCKETS; i++) {
+        live_objs += profile_buckets[i].live_objs;
+        live_bytes += profile_buckets[i].live_bytes;
+        total_objs += profile_buckets[i].total_objs;
+        total_bytes += profile_buckets[i].total_bytes;
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    // The first write may allocate the stream's buffer, and a sampled
+    // allocation takes profile_lock, so write the header without holding it.
+    fprintf(out, "heap profile: %zu: %zu [ %zu: %zu] @ heap_v2/%zu\n",
+            live_objs, live_bytes, total_objs, total_bytes, profile_last_rate);
+    pthread_mutex_lock(&profile_lock);
+    for (size_t i = 0; profile_buckets && i < PROFILE_BUCKETS; i++) {
+        ProfileBucket *b = &profile_buckets[i];
+        if (!b->total_objs) continue;
+        fprintf(out, "%zu: %zu [%zu: %zu] @", b->live_objs, b->live_bytes, b->total_objs, b->total_bytes);
+        for (int f = 0; f < b->depth; f++) fprintf(out, " 0x%" PRIxPTR, (uintptr_t)b->stack[f]);
+        fputc('\n', out);
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    // pprof maps the addresses back to binaries with the process's mappings.
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0) return;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) fwrite(buf, 1, (size_t)n, out);
+    close(fd);
+}
+
+/**
+ * @brief Prints one list of runs of a size class, if it is not empty.
+ * @param c The size class.
+ * @param label A suffix for the class heading.
+ * @param list The first run of the list.
+ */
+static void dump_runs(int c, const char *label, Run *list) {
+    if (!list) return;
+    printf("Class[%d] (%u bytes%s): ", c, class_size[c], label);
+    for (Run *r = list; r; r = r->next) {
+        printf("[%u/%u free]", r->nfree, r->nobjs);
+        if (r->next) printf("->");
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Dumps the current state of the heap to the console.
+ *
+ * For every NUMA node with memory, this function prints the contents of each
+ * non-empty bin, followed by the calling thread's runs and the orphan runs of
+ * each small size class. Objects
+ * waiting on a remote-free stack are counted as allocated.
+ */
+void my_dump() {
+    pthread_once(&nodes_once, nodes_init);
+    for (int i = 0; i < num_nodes; i++) {
+        Node *nd = &nodes[i];
+        pthread_mutex_lock(&nd->lock);
+        Chunk *first = nd->first_chunk;
+        pthread_mutex_unlock(&nd->lock);
+        if (!first) continue;
+
+        // Print the headings before taking the lock: stdout may allocate its
+        // buffer on first use, which must not happen under a node lock when
+        // this allocator is malloc itself.
+        if (num_nodes > 1) printf("=== Node %d ===\n", nd->id);
+        printf("=== Heap bins ===\n");
+        pthread_mutex_lock(&nd->lock);
+        for (int fl = 0; fl < FL_COUNT; fl++) {
+            for (int sl = 0; sl < SL_COUNT; sl++) {
+                Block *b = nd->bin[fl][sl];
+                if (!b) continue;
+                printf("Bin[%d][%d]: ", fl, sl);
+                while (b) {
+                    printf("[%zu]", block_size(b));
+                    b = load_link(&b->next_free);
+                    if (b) printf("->");
+                }
+                printf("\n");
+            }
+        }
+        for (int i = 0; i < FAST_BINS; i++) {
+            FastBin *fb = &nd->fast[i];
+            pthread_spin_lock(&fb->lock);
+            Block *b = atomic_load_explicit(&fb->first, memory_order_relaxed);
+            if (b) printf("Fastbin[%d]: ", i);
+            for (; b; b = load_link(&b->next_free)) {
+                printf("[%zu]", block_size(b));
+                if (load_link(&b->next_free)) printf("->");
+                else printf("\n");
+            }
+            pthread_spin_unlock(&fb->lock);
+        }
+        printf("=== Slab classes ===\n");
+        for (int c = 0; c < NUM_CLASSES; c++) {
+            if (theap && theap->node == nd) dump_runs(c, "", theap->runs[c]);
+            dump_runs(c, ", orphan", nd->partial[c]);
+        }
+        pthread_mutex_unlock(&nd->lock);
+    }
+}
+
+const struct my_backend my_backend_adv = {
+    "adv", "TLSF bins and slab runs", 1, my_malloc, my_free, my_calloc, my_realloc, my_dump,
+};
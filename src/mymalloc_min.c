@@ -2,20 +2,50 @@
  * @file mymalloc_min.c
  * @brief A minimal educational implementation of a custom memory allocator.
  *
- * This implementation uses a single static array as a heap and a simple
- * first-fit algorithm to manage memory blocks. It does not support coalescing
- * of free blocks, focusing instead on clarity and simplicity.
+ * This implementation uses a single static array as a heap, kept as a doubly
+ * linked list of blocks in address order. A free block is merged with its
+ * free neighbors, so the list does not fill up with fragments too small for
+ * any request. The search policy is chosen at compile time with
+ * MIN_FIT_POLICY: first-fit (the default), next-fit or best-fit. The design
+ * otherwise favors clarity and simplicity.
+ *
+ * Its entry points are prefixed min_, so that it can be linked next to the
+ * advanced allocator; mymalloc_min.h maps the my_ names onto them for
+ * programs that use it alone.
  */
 
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
+#include "mymalloc.h"
+#include "mymalloc_min.h"
+
 // The total size of the heap in bytes (1 MB).
 #define HEAP_SIZE 1024 * 1024
 // The alignment for allocated memory in bytes.
 #define ALIGN     8
 
+// The search policies. First-fit takes the first free block that fits from
+// the start of the heap, next-fit resumes where the previous search stopped,
+// and best-fit takes the smallest block that fits.
+#define MIN_FIRST_FIT 0
+#define MIN_NEXT_FIT  1
+#define MIN_BEST_FIT  2
+#ifndef MIN_FIT_POLICY
+#define MIN_FIT_POLICY MIN_FIRST_FIT
+#endif
+
+// The policy's name, reported by my_backend_min.
+#if MIN_FIT_POLICY == MIN_NEXT_FIT
+#define POLICY_NAME "next-fit list"
+#elif MIN_FIT_POLICY == MIN_BEST_FIT
+#define POLICY_NAME "best-fit list"
+#else
+#define POLICY_NAME "first-fit list"
+#endif
+
 // The static array that represents our heap.
 static unsigned char heap[HEAP_SIZE];
 
@@ -23,16 +53,21 @@ static unsigned char heap[HEAP_SIZE];
  * @brief Represents a block of memory in the heap.
  *
  * Each block has a header that contains metadata about the block, including
- * its size, whether it is free, and a pointer to the next block in the heap.
+ * its size, whether it is free, and pointers to its neighbors in the heap.
  */
 typedef struct Block {
     size_t size;        ///< The size of the payload area in bytes.
     int free;           ///< 1 if the block is free, 0 if it is in use.
     struct Block *next; ///< A pointer to the next block in the heap.
+    struct Block *prev; ///< A pointer to the previous block in the heap.
 } Block;
 
 // A pointer to the first block in the heap.
 static Block *free_list = NULL;
+#if MIN_FIT_POLICY == MIN_NEXT_FIT
+// The block the last next-fit search settled on.
+static Block *rover = NULL;
+#endif
 
 /**
  * @brief Aligns a size to the next multiple of ALIGN.
@@ -49,19 +84,45 @@ static size_t align8(size_t size) {
  * This function is called once when the allocator is first used. It sets up
  * a single large free block that covers the entire heap.
  */
-void my_init() {
+void min_init() {
     free_list = (Block*)heap;
     free_list->size = HEAP_SIZE - sizeof(Block);
     free_list->free = 1;
     free_list->next = NULL;
+    free_list->prev = NULL;
+#if MIN_FIT_POLICY == MIN_NEXT_FIT
+    rover = free_list;
+#endif
 }
 
 /**
- * @brief Finds the first free block that is large enough to hold a given size.
+ * @brief Finds a free block that is large enough to hold a given size.
+ *
+ * Which one depends on MIN_FIT_POLICY.
+ *
  * @param size The required size of the payload.
- * @return A pointer to the first suitable free block, or NULL if none is found.
+ * @return A pointer to a suitable free block, or NULL if none is found.
  */
 static Block *find_free(size_t size) {
+#if MIN_FIT_POLICY == MIN_NEXT_FIT
+    // Start from the rover and wrap around to it at most once.
+    Block *curr = rover;
+    do {
+        if (curr->free && curr->size >= size)
+            return rover = curr;
+        curr = curr->next ? curr->next : free_list;
+    } while (curr != rover);
+    return NULL;
+#elif MIN_FIT_POLICY == MIN_BEST_FIT
+    // Scan the whole heap unless a block fits exactly.
+    Block *best = NULL;
+    for (Block *curr = free_list; curr; curr = curr->next) {
+        if (!curr->free || curr->size < size) continue;
+        if (!best || curr->size < best->size) best = curr;
+        if (curr->size == size) break;
+    }
+    return best;
+#else
     Block *curr = free_list;
     while (curr) {
         if (curr->free && curr->size >= size)
@@ -69,6 +130,7 @@ static Block *find_free(size_t size) {
         curr = curr->next;
     }
     return NULL;
+#endif
 }
 
 /**
@@ -89,6 +151,8 @@ static void split(Block *blk, size_t size) {
         new_blk->size = blk->size - size - sizeof(Block);
         new_blk->free = 1;
         new_blk->next = blk->next;
+        new_blk->prev = blk;
+        if (new_blk->next) new_blk->next->prev = new_blk;
 
         // Update the original block.
         blk->size = size;
@@ -96,15 +160,33 @@ static void split(Block *blk, size_t size) {
     }
 }
 
+/**
+ * @brief Merges a block with the block that follows it.
+ *
+ * The caller must make sure the next block exists and is free.
+ *
+ * @param blk The block that absorbs its successor.
+ */
+static void merge_next(Block *blk) {
+    Block *next = blk->next;
+    blk->size += sizeof(Block) + next->size;
+    blk->next = next->next;
+    if (blk->next) blk->next->prev = blk;
+#if MIN_FIT_POLICY == MIN_NEXT_FIT
+    if (rover == next) rover = blk;
+#endif
+}
+
 /**
  * @brief Allocates a block of memory of a given size.
  * @param size The number of bytes to allocate.
  * @return A pointer to the allocated memory, or NULL if the allocation fails.
  */
-void *my_malloc(size_t size) {
+void *min_malloc(size_t size) {
     // Initialize the heap if it has not been initialized yet.
-    if (!free_list) my_init();
-    if (size == 0) return NULL;
+    if (!free_list) min_init();
+    // Larger sizes cannot fit, and aligning them could wrap around to zero.
+    if (size == 0 || size > HEAP_SIZE) return NULL;
 
     // Align the requested size.
     size = align8(size);
@@ -125,7 +207,7 @@ void *my_malloc(size_t size) {
  * @brief Frees a previously allocated block of memory.
  * @param ptr A pointer to the memory to free.
  */
-void my_free(void *ptr) {
+void min_free(void *ptr) {
     if (!ptr) return;
 
     // Check if the pointer is within the heap range.
@@ -143,19 +225,25 @@ void my_free(void *ptr) {
         return;
     }
 
-    // Mark the block as free.
+    // Mark the block as free and merge it with its free neighbors. Its header
+    // keeps the free flag even if it is merged away, so that a second free of
+    // the same pointer is still caught.
     blk->free = 1;
+    if (blk->next && blk->next->free) merge_next(blk);
+    if (blk->prev && blk->prev->free) merge_next(blk->prev);
 }
 
 /**
  * @brief Allocates and zeros out a block of memory.
  * @param n The number of elements to allocate.
  * @param s The size of each element.
- * @return A pointer to the allocated and zeroed memory, or NULL on failure.
+ * @return A pointer to the allocated and zeroed memory, or NULL on failure,
+ *         including when n * s overflows.
  */
-void *my_calloc(size_t n, size_t s) {
+void *min_calloc(size_t n, size_t s) {
+    if (s && n > SIZE_MAX / s) return NULL;
     size_t total = n * s;
-    void *p = my_malloc(total);
+    void *p = min_malloc(total);
     if (p) memset(p, 0, total);
     return p;
 }
@@ -166,17 +254,35 @@ void *my_calloc(size_t n, size_t s) {
  * @param new_size The new size of the memory block.
  * @return A pointer to the resized memory block, or NULL on failure.
  */
-void *my_realloc(void *ptr, size_t new_size) {
-    if (!ptr) return my_malloc(new_size);
+void *min_realloc(void *ptr, size_t new_size) {
+    if (!ptr) return min_malloc(new_size);
+    if (new_size > HEAP_SIZE) return NULL;
 
     Block *blk = (Block*)((char*)ptr - sizeof(Block));
-    if (blk->size >= new_size) return ptr;
+    size_t size = align8(new_size);
+
+    if (blk->size >= size) {
+        // Shrink in place: split the tail off and merge it with a free successor.
+        Block *next = blk->next;
+        split(blk, size);
+        Block *tail = blk->next;
+        if (tail != next && tail->next != NULL && tail->next->free) merge_next(tail);
+        return ptr;
+    }
+
+    // Grow in place by absorbing a free successor that makes up the difference.
+    Block *next = blk->next;
+    if (next != NULL && next->free && blk->size + sizeof(Block) + next->size >= size) {
+        merge_next(blk);
+        split(blk, size);
+        return ptr;
+    }
 
     // Allocate a new block, copy the data, and free the old block.
-    void *newp = my_malloc(new_size);
+    void *newp = min_malloc(new_size);
     if (!newp) return NULL;
     memcpy(newp, ptr, blk->size);
-    my_free(ptr);
+    min_free(ptr);
     return newp;
 }
 
@@ -186,7 +292,7 @@ void *my_realloc(void *ptr, size_t new_size) {
  * This function iterates through all the blocks in the heap and prints
  * information about each block, including its address, size, and free status.
  */
-void my_dump() {
+void min_dump() {
     Block *curr = free_list;
     printf("Heap dump:\n");
     while (curr) {
@@ -194,4 +300,76 @@ void my_dump() {
             (void*)curr, (unsigned long)curr->size, curr->free, (void*)curr->next);
         curr = curr->next;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Visits every block of the heap in physical order.
+ * @param fn The callback.
+ * @param arg Passed to the callback.
+ */
+void min_heap_walk(min_heap_walker fn, void *arg) {
+    for (Block *curr = free_list; curr; curr = curr->next) {
+        struct min_block_info info;
+        info.offset = (size_t)((unsigned char*)curr - heap);
+        info.size = curr->size;
+        info.free = curr->free;
+        fn(&info, arg);
+    }
+}
+
+/**
+ * @brief The state of a JSON dump in progress.
+ */
+typedef struct JsonDump {
+    FILE *out;          ///< The stream being written.
+    size_t blocks;      ///< The number of blocks written so far.
+    size_t count[64];   ///< Free blocks by floor(log2(size)).
+    size_t bytes[64];   ///< Free bytes by floor(log2(size)).
+    size_t free;        ///< All free bytes.
+    size_t largest;     ///< The largest free block.
+} JsonDump;
+
+/**
+ * @brief Writes one block of a JSON dump and adds it to the histogram.
+ * @param info The block.
+ * @param arg The JsonDump.
+ */
+static void json_block(const struct min_block_info *info, void *arg) {
+    JsonDump *d = arg;
+    fprintf(d->out, "%s\n    {\"offset\":%zu,\"size\":%zu,\"state\":\"%s\"}",
+            d->blocks++ ? "," : "", info->offset, info->size, info->free ? "free" : "used");
+
+    if (!info->free || !info->size) return;
+    int bucket = 0;
+    while (bucket < 63 && info->size >> (bucket + 1)) bucket++;
+    d->count[bucket]++;
+    d->bytes[bucket] += info->size;
+    d->free += info->size;
+    if (info->size > d->largest) d->largest = info->size;
+}
+
+/**
+ * @brief Writes the physical heap layout as JSON.
+ * @param out The stream to write to.
+ */
+void min_dump_json(FILE *out) {
+    JsonDump d;
+    memset(&d, 0, sizeof(d));
+    d.out = out;
+    fprintf(out, "{\n  \"blocks\": [");
+    min_heap_walk(json_block, &d);
+    fprintf(out, "\n  ],\n  \"histogram\": [");
+    int first = 1;
+    for (int i = 0; i < 64; i++) {
+        if (!d.count[i]) continue;
+        fprintf(out, "%s\n    {\"min_size\":%zu,\"count\":%zu,\"bytes\":%zu}",
+                first ? "" : ",", (size_t)1 << i, d.count[i], d.bytes[i]);
+        first = 0;
+    }
+    fprintf(out, "\n  ],\n  \"free\": %zu,\n  \"largest_free\": %zu,\n  \"fragmentation\": %.4f\n}\n",
+            d.free, d.largest, d.free ? 1.0 - (double)d.largest / (double)d.free : 0.0);
+}
+
+const struct my_backend my_backend_min = {
+    "min", POLICY_NAME, 0, min_malloc, min_free, min_calloc, min_realloc, min_dump,
+};
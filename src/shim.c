@@ -0,0 +1,156 @@
+/**
+ * @file shim.c
+ * @brief Exports the standard C allocation functions on top of the advanced allocator.
+ *
+ * Linked into libmymalloc.so together with mymalloc_adv.c and shim_new.cpp,
+ * this lets any dynamically linked program use the allocator through
+ * LD_PRELOAD without being rebuilt. The functions only translate between the
+ * libc contracts and the my_ API: errno is set on failure and the extra entry
+ * points glibc offers map onto the aligned API.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "mymalloc_adv.h"
+
+// The page size assumed by valloc and pvalloc.
+#define PAGE_SIZE 4096
+
+/**
+ * @brief Sets errno to ENOMEM if an allocation failed.
+ * @param p The result of the allocation.
+ * @return p.
+ */
+static void *check(void *p) {
+    if (!p) errno = ENOMEM;
+    return p;
+}
+
+/**
+ * @brief Allocates memory; see malloc(3).
+ * @param size The number of bytes to allocate.
+ * @return The memory, or NULL with errno set.
+ */
+void *malloc(size_t size) {
+    return check(my_malloc(size));
+}
+
+/**
+ * @brief Frees memory; see free(3).
+ * @param ptr The memory, or NULL.
+ */
+void free(void *ptr) {
+    my_free(ptr);
+}
+
+/**
+ * @brief Allocates zeroed memory for an array; see calloc(3).
+ * @param n The number of elements.
+ * @param size The size of each element.
+ * @return The memory, or NULL with errno set.
+ */
+void *calloc(size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return check(my_calloc(n, size));
+}
+
+/**
+ * @brief Resizes memory; see realloc(3).
+ * @param ptr The memory, or NULL.
+ * @param size The new size.
+ * @return The resized memory, or NULL with errno set and ptr untouched.
+ */
+void *realloc(void *ptr, size_t size) {
+    return check(my_realloc(ptr, size));
+}
+
+/**
+ * @brief Resizes memory for an array; see reallocarray(3).
+ * @param ptr The memory, or NULL.
+ * @param n The number of elements.
+ * @param size The size of each element.
+ * @return The resized memory, or NULL with errno set and ptr untouched.
+ */
+void *reallocarray(void *ptr, size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return check(my_realloc(ptr, n * size));
+}
+
+/**
+ * @brief Allocates aligned memory; see posix_memalign(3).
+ * @param memptr Receives the memory.
+ * @param alignment The alignment, a power of two multiple of sizeof(void *).
+ * @param size The number of bytes to allocate.
+ * @return 0, EINVAL or ENOMEM.
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    return my_posix_memalign(memptr, alignment, size);
+}
+
+/**
+ * @brief Allocates aligned memory; see aligned_alloc(3).
+ * @param alignment The alignment, a power of two.
+ * @param size The number of bytes to allocate.
+ * @return The memory, or NULL with errno set.
+ */
+void *aligned_alloc(size_t alignment, size_t size) {
+    if (!alignment || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return check(my_aligned_alloc(alignment, size));
+}
+
+/**
+ * @brief Allocates aligned memory; see memalign(3).
+ *
+ * The dynamic loader uses this for thread-local storage blocks.
+ *
+ * @param alignment The alignment, a power of two.
+ * @param size The number of bytes to allocate.
+ * @return The memory, or NULL with errno set.
+ */
+void *memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+/**
+ * @brief Allocates page-aligned memory; see valloc(3).
+ * @param size The number of bytes to allocate.
+ * @return The memory, or NULL with errno set.
+ */
+void *valloc(size_t size) {
+    return check(my_aligned_alloc(PAGE_SIZE, size));
+}
+
+/**
+ * @brief Allocates whole pages; see pvalloc(3).
+ * @param size The number of bytes to allocate, rounded up to a page.
+ * @return The memory, or NULL with errno set.
+ */
+void *pvalloc(size_t size) {
+    if (size > SIZE_MAX - PAGE_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return check(my_aligned_alloc(PAGE_SIZE, (size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1)));
+}
+
+/**
+ * @brief Returns the usable size of an allocation; see malloc_usable_size(3).
+ * @param ptr The memory, or NULL.
+ * @return The usable size, or 0 for NULL.
+ */
+size_t malloc_usable_size(void *ptr) {
+    return my_malloc_usable_size(ptr);
+}
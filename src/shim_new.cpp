@@ -0,0 +1,89 @@
+/**
+ * @file shim_new.cpp
+ * @brief Replaces the C++ global operator new and delete with the advanced allocator.
+ *
+ * Part of libmymalloc.so. Every replaceable form is covered: plain, array,
+ * nothrow, sized and aligned. Sized deletes of unaligned objects go through
+ * my_free_sized, which skips the chunk lookup for small objects.
+ */
+
+#include <cstddef>
+#include <new>
+
+extern "C" {
+#include "mymalloc_adv.h"
+}
+
+namespace {
+
+/**
+ * @brief Allocates as operator new does, retrying through the new handler.
+ * @param size The number of bytes to allocate.
+ * @param align The alignment, or 0 for the default.
+ * @return The memory, or nullptr if allocation failed and there is no handler.
+ */
+void *new_impl(std::size_t size, std::size_t align) noexcept {
+    for (;;) {
+        void *p = align ? my_aligned_alloc(align, size) : my_malloc(size);
+        if (p) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) return nullptr;
+        try {
+            handler();
+        } catch (...) {
+            return nullptr;
+        }
+    }
+}
+
+/**
+ * @brief Allocates as the throwing operator new does.
+ * @param size The number of bytes to allocate.
+ * @param align The alignment, or 0 for the default.
+ * @return The memory.
+ */
+void *new_or_throw(std::size_t size, std::size_t align) {
+    for (;;) {
+        void *p = align ? my_aligned_alloc(align, size) : my_malloc(size);
+        if (p) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+} // namespace
+
+void *operator new(std::size_t size) { return new_or_throw(size, 0); }
+void *operator new[](std::size_t size) { return new_or_throw(size, 0); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return new_impl(size, 0); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return new_impl(size, 0); }
+
+void *operator new(std::size_t size, std::align_val_t align) {
+    return new_or_throw(size, static_cast<std::size_t>(align));
+}
+void *operator new[](std::size_t size, std::align_val_t align) {
+    return new_or_throw(size, static_cast<std::size_t>(align));
+}
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return new_impl(size, static_cast<std::size_t>(align));
+}
+void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return new_impl(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void *ptr) noexcept { my_free(ptr); }
+void operator delete[](void *ptr) noexcept { my_free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { my_free(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { my_free(ptr); }
+void operator delete(void *ptr, std::size_t size) noexcept { my_free_sized(ptr, size); }
+void operator delete[](void *ptr, std::size_t size) noexcept { my_free_sized(ptr, size); }
+
+// Aligned objects may not come from the size class their size maps to, so
+// their sized deletes cannot use my_free_sized.
+void operator delete(void *ptr, std::align_val_t) noexcept { my_free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { my_free(ptr); }
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { my_free(ptr); }
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { my_free(ptr); }
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { my_free(ptr); }
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept { my_free(ptr); }
@@ -8,26 +8,47 @@
  * scenarios.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef ADVANCED_ALLOCATOR
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+#endif
 
 // Use a macro to switch between the minimal and advanced allocators.
+#include "mymalloc.h"
 #ifdef ADVANCED_ALLOCATOR
 #include "mymalloc_adv.h"
+#include "mymalloc_trace.h"
 #else
 #include "mymalloc_min.h"
 #endif
 
 // The alignment for allocated memory in bytes.
+#ifdef ADVANCED_ALLOCATOR
+#define ALIGN 16
+#else
 #define ALIGN 8
+#endif
 // The number of iterations for the stress test.
 #define STRESS_ITERATIONS 10000
 // The maximum size of a single allocation in the stress test.
 #define MAX_ALLOCATION_SIZE 4096
+// The number of threads used by the multithreaded test.
+#define NUM_THREADS 8
+// The number of allocations each thread performs in the multithreaded test.
+#define THREAD_ITERATIONS 20000
 
 /**
  * @brief Checks if a pointer is aligned to a given boundary.
@@ -114,6 +135,18 @@ void test_realloc() {
     }
     my_free(p2);
 
+    // Test that a shrink releases the tail and a later grow reclaims it
+    // without moving the block.
+    char *p3 = my_malloc(3000);
+    assert(p3 != NULL);
+    memset(p3, 'c', 3000);
+    assert(my_realloc(p3, 1500) == p3);
+    assert(my_realloc(p3, 2500) == p3);
+    for (int i = 0; i < 1500; i++) {
+        assert(p3[i] == 'c');
+    }
+    my_free(p3);
+
     printf("realloc test passed.\n");
 }
 
@@ -131,14 +164,59 @@ void test_calloc() {
         assert(p[i] == 0);
     }
     my_free(p);
+
+    // A large block that was used before must be cleared, too.
+    size_t big = 300 * 1000;
+    unsigned char *q = my_malloc(big);
+    assert(q != NULL);
+    memset(q, 0xff, big);
+    my_free(q);
+    q = my_calloc(big / 4, 4);
+    assert(q != NULL);
+    for (size_t i = 0; i < big; i++) assert(q[i] == 0);
+    my_free(q);
+
+    // Sizes that overflow fail instead of wrapping around.
+    assert(my_calloc(SIZE_MAX / 2 + 1, 2) == NULL);
+    assert(my_malloc(SIZE_MAX) == NULL);
+#ifdef ADVANCED_ALLOCATOR
+    assert(my_aligned_alloc((size_t)1 << 62, 64) == NULL);
+#endif
     printf("calloc test passed.\n");
 }
 
+/**
+ * @brief Tests the allocator through its backend description.
+ *
+ * The struct my_backend must reach the same allocator the my_ names do.
+ */
+void test_backend() {
+    printf("--- Testing Backend Interface ---\n");
+#ifdef ADVANCED_ALLOCATOR
+    const struct my_backend *be = &my_backend_adv;
+    assert(!strcmp(be->name, "adv") && be->thread_safe);
+#else
+    const struct my_backend *be = &my_backend_min;
+    assert(!strcmp(be->name, "min") && !be->thread_safe);
+#endif
+    char *p = be->malloc(64);
+    assert(p != NULL);
+    memset(p, 'x', 64);
+    p = be->realloc(p, 128);
+    assert(p != NULL && p[63] == 'x');
+    char *z = be->calloc(16, 4);
+    assert(z != NULL && z[0] == 0 && z[63] == 0);
+    be->free(z);
+    my_free(p);
+    printf("Backend interface test passed.\n");
+}
+
 /**
  * @brief Tests the allocator's handling of invalid free operations.
  *
  * This test checks for correct handling of double-freeing and freeing of
- * pointers that are not managed by the allocator.
+ * pointers that are not managed by the allocator, including a page-aligned
+ * one with nothing mapped in front of it.
  */
 void test_invalid_free() {
     printf("--- Testing Invalid Free ---\n");
@@ -156,9 +234,1166 @@ void test_invalid_free() {
     printf("Attempting to free a pointer outside the heap...\n");
     my_free(p2);
 
+    // Test freeing a page-aligned foreign pointer whose previous page, where
+    // a huge allocation's header would be, is not mapped.
+    long page = sysconf(_SC_PAGESIZE);
+    char *map = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(map != MAP_FAILED);
+    assert(munmap(map, page) == 0);
+    printf("Attempting to free a pointer after an unmapped page...\n");
+    my_free(map + page);
+#ifdef ADVANCED_ALLOCATOR
+    // Foreign pointers have no usable size and cannot be resized.
+    assert(my_malloc_usable_size(map + page) == 0);
+    assert(my_malloc_usable_size(p2) == 0);
+    printf("Attempting to realloc a pointer outside the heap...\n");
+    assert(my_realloc(map + page, 100) == NULL);
+#endif
+    munmap(map + page, page);
+
     printf("Invalid free test completed.\n");
 }
 
+/**
+ * @brief Totals gathered by a heap walk.
+ */
+typedef struct WalkTotals {
+    size_t blocks;    ///< The number of blocks visited.
+    size_t used;      ///< The payload bytes of allocated blocks.
+    size_t free;      ///< The payload bytes of free blocks.
+} WalkTotals;
+
+/**
+ * @brief Heap walk callback that adds a block to a WalkTotals.
+ * @param info The block.
+ * @param arg The WalkTotals.
+ */
+static void walk_totals(const struct my_block_info *info, void *arg) {
+    WalkTotals *t = arg;
+#ifdef ADVANCED_ALLOCATOR
+    int is_free = info->state == MY_BLOCK_FREE || info->state == MY_BLOCK_FAST;
+#else
+    int is_free = info->free;
+#endif
+    t->blocks++;
+    if (is_free) t->free += info->size;
+    else t->used += info->size;
+}
+
+#ifdef ADVANCED_ALLOCATOR
+// Where dump_signal writes, and what it returned.
+static int dump_fd;
+static volatile sig_atomic_t dump_result;
+
+/**
+ * @brief Signal handler that dumps the heap as JSON.
+ *
+ * The buffer is small so that the dump goes out in many writes.
+ *
+ * @param sig The signal.
+ */
+static void dump_signal(int sig) {
+    (void)sig;
+    char buf[64];
+    dump_result = my_dump_json_fd(dump_fd, buf, sizeof(buf));
+}
+#endif
+
+/**
+ * @brief Tests the heap walk and the JSON dump.
+ *
+ * An allocation must show up as used bytes in the walk and disappear again
+ * once it is freed, and the dump must contain the histogram, also when it
+ * is written from a signal handler.
+ */
+void test_heap_walk() {
+    printf("--- Testing Heap Walk ---\n");
+    WalkTotals before = {0}, during = {0}, after = {0};
+    my_heap_walk(walk_totals, &before);
+    // The advanced allocator serves small sizes from slab runs, which may
+    // not change the layout, so ask for a heap block there.
+#ifdef ADVANCED_ALLOCATOR
+    size_t size = 5000;
+#else
+    size_t size = 200;
+#endif
+    void *p = my_malloc(size);
+    assert(p != NULL);
+    my_heap_walk(walk_totals, &during);
+    assert(during.blocks > 0 && during.used >= before.used + size);
+    my_free(p);
+    my_heap_walk(walk_totals, &after);
+    assert(after.used == before.used);
+
+    // Check the head and the tail of the dump, which may be long.
+    FILE *f = tmpfile();
+    assert(f != NULL);
+    my_dump_json(f);
+    char buf[128];
+    long len = ftell(f);
+    rewind(f);
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    assert(buf[0] == '{' && strstr(buf, "\"blocks\"") != NULL);
+    fseek(f, len > (long)n ? len - (long)n : 0, SEEK_SET);
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    assert(strstr(buf, "\"fragmentation\"") != NULL);
+    fclose(f);
+
+#ifdef ADVANCED_ALLOCATOR
+    f = tmpfile();
+    assert(f != NULL);
+    dump_fd = fileno(f);
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dump_signal;
+    assert(sigaction(SIGUSR1, &sa, &old) == 0);
+    raise(SIGUSR1);
+    assert(sigaction(SIGUSR1, &old, NULL) == 0);
+    assert(dump_result == 1);
+    len = lseek(dump_fd, 0, SEEK_END);
+    assert(len > (long)sizeof(buf));
+    assert(pread(dump_fd, buf, 16, 0) == 16 && buf[0] == '{');
+    n = (size_t)pread(dump_fd, buf, sizeof(buf) - 1, len - (long)sizeof(buf) + 1);
+    buf[n] = '\0';
+    assert(strstr(buf, "\"skipped_nodes\": 0") != NULL && strstr(buf, "\"fragmentation\"") != NULL);
+    fclose(f);
+#endif
+    printf("Heap walk test passed.\n");
+}
+
+#ifndef ADVANCED_ALLOCATOR
+/**
+ * @brief Tests that freed neighbors are merged.
+ *
+ * Fills half the heap with small blocks and frees every other one first, so
+ * that no free block has a free neighbor until the rest go. A request as
+ * large as all of them together then only fits if they were merged.
+ */
+void test_coalesce() {
+    printf("--- Testing Coalescing ---\n");
+    enum { COUNT = 1000, SIZE = 512 };
+    static void *ptrs[COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        ptrs[i] = my_malloc(SIZE);
+        assert(ptrs[i] != NULL);
+    }
+    for (int i = 0; i < COUNT; i += 2) my_free(ptrs[i]);
+    for (int i = 1; i < COUNT; i += 2) my_free(ptrs[i]);
+
+    void *big = my_malloc(COUNT * SIZE);
+    assert(big != NULL);
+    my_free(big);
+    printf("Coalescing test passed.\n");
+}
+#endif
+
+#ifdef ADVANCED_ALLOCATOR
+/**
+ * @brief Tests that the heap grows past its first chunk.
+ *
+ * Allocates buffers below the mmap threshold that together exceed the first
+ * chunks, touches every byte and frees them again.
+ */
+void test_growth() {
+    printf("--- Testing Heap Growth ---\n");
+    enum { COUNT = 32, SIZE = 512 * 1024 };
+    unsigned char *bufs[COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        bufs[i] = my_malloc(SIZE);
+        assert(bufs[i] != NULL);
+        memset(bufs[i], i, SIZE);
+    }
+    for (int i = 0; i < COUNT; i++) {
+        assert(bufs[i][0] == i && bufs[i][SIZE - 1] == i);
+        my_free(bufs[i]);
+    }
+    printf("Heap growth test passed.\n");
+}
+
+/**
+ * @brief Tests the aligned allocation API.
+ *
+ * Covers small objects, heap blocks and huge mappings for alignments from
+ * the default up to beyond a page.
+ */
+void test_aligned() {
+    printf("--- Testing Aligned Allocation ---\n");
+    static const size_t sizes[] = { 1, 100, 1000, 5000, 2 * 1024 * 1024 };
+    for (size_t align = 16; align <= 16384; align *= 2) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            unsigned char *p = my_aligned_alloc(align, sizes[i]);
+            assert(p != NULL);
+            assert(is_aligned(p, align));
+            memset(p, 'x', sizes[i]);
+            my_free(p);
+        }
+    }
+
+    void *p = NULL;
+    assert(my_posix_memalign(&p, 64, 200) == 0);
+    assert(p != NULL && is_aligned(p, 64));
+    my_free(p);
+    assert(my_posix_memalign(&p, 24, 200) != 0);
+    assert(my_aligned_alloc(48, 200) == NULL);
+    printf("Aligned allocation test passed.\n");
+}
+
+/**
+ * @brief Tests my_malloc_usable_size and my_free_sized.
+ *
+ * Every allocation must report at least the requested size, and the whole
+ * usable size must be writable.
+ */
+void test_sized() {
+    printf("--- Testing Sized Free ---\n");
+    static const size_t sizes[] = { 1, 16, 17, 100, 1000, 1024, 1025, 60000, 3 * 1024 * 1024 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned char *p = my_malloc(sizes[i]);
+        assert(p != NULL);
+        size_t usable = my_malloc_usable_size(p);
+        assert(usable >= sizes[i]);
+        memset(p, 's', usable);
+        my_free_sized(p, sizes[i]);
+    }
+
+    // A shrink across a class boundary must keep sized free consistent.
+    char *p = my_malloc(1000);
+    assert(p != NULL);
+    p = my_realloc(p, 20);
+    assert(p != NULL && my_malloc_usable_size(p) < 1000);
+    my_free_sized(p, 20);
+    assert(my_malloc_usable_size(NULL) == 0);
+    printf("Sized free test passed.\n");
+}
+
+/**
+ * @brief Tests my_malloc_batch and my_free_batch.
+ *
+ * Allocates batches of small, mid-size and huge objects, checks that they
+ * are aligned and disjoint, and frees each batch in one call.
+ */
+void test_batch() {
+    printf("--- Testing Batch Allocation ---\n");
+    enum { COUNT = 500 };
+    static const size_t sizes[] = { 24, 1000, 4000, 2 * 1024 * 1024 };
+    void *ptrs[COUNT];
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t n = sizes[i] > 1024 * 1024 ? 4 : COUNT;
+        assert(my_malloc_batch(sizes[i], n, ptrs) == n);
+        for (size_t j = 0; j < n; j++) {
+            assert((uintptr_t)ptrs[j] % ALIGN == 0);
+            assert(my_malloc_usable_size(ptrs[j]) >= sizes[i]);
+            memset(ptrs[j], (int)j, sizes[i]);
+        }
+        for (size_t j = 0; j < n; j++) assert(((unsigned char*)ptrs[j])[sizes[i] - 1] == (unsigned char)j);
+        ptrs[n / 2] = NULL;
+        my_free(ptrs[n / 2 + 1]);
+        ptrs[n / 2 + 1] = NULL;
+        my_free_batch(ptrs, n);
+    }
+
+    // Freed batches must be reusable as one large block.
+    void *p = my_malloc(COUNT * 4000);
+    assert(p != NULL);
+    my_free(p);
+    assert(my_malloc_batch(64, 0, ptrs) == 0);
+    printf("Batch allocation test passed.\n");
+}
+
+/**
+ * @brief Tests the arena API.
+ *
+ * Fills an arena with small and large allocations over several rounds,
+ * checking alignment and contents, and resets it between rounds.
+ */
+void test_arena() {
+    printf("--- Testing Arenas ---\n");
+    enum { COUNT = 2000 };
+    static unsigned char *ptrs[COUNT];
+    my_arena_t *a = my_arena_create(0);
+    assert(a != NULL);
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < COUNT; i++) {
+            size_t size = i % 100 == 0 ? 20000 : (size_t)(i % 200) + 1;
+            ptrs[i] = my_arena_alloc(a, size);
+            assert(ptrs[i] != NULL);
+            assert((uintptr_t)ptrs[i] % ALIGN == 0);
+            memset(ptrs[i], i & 0xff, size);
+        }
+        for (int i = 0; i < COUNT; i++) {
+            size_t size = i % 100 == 0 ? 20000 : (size_t)(i % 200) + 1;
+            assert(ptrs[i][0] == (i & 0xff) && ptrs[i][size - 1] == (i & 0xff));
+        }
+        my_arena_reset(a);
+    }
+    my_arena_destroy(a);
+    printf("Arena test passed.\n");
+}
+
+/**
+ * @brief Worker for the heap test: fills a heap, then frees half of it.
+ *
+ * Sizes range from tiny to larger than a chunk, and every allocation must
+ * come from the heap.
+ *
+ * @param arg The heap, shared with other workers.
+ * @return NULL.
+ */
+static void *heap_worker(void *arg) {
+    my_heap_t *h = arg;
+    enum { COUNT = 500 };
+    unsigned char *ptrs[COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        size_t size = i % 250 == 0 ? 5 << 20 : (size_t)(i * 37 % 9000) + 1;
+        ptrs[i] = my_heap_malloc(h, size);
+        assert(ptrs[i] != NULL);
+        assert((uintptr_t)ptrs[i] % ALIGN == 0);
+        memset(ptrs[i], i & 0xff, size);
+    }
+    for (int i = 0; i < COUNT; i += 2) {
+        size_t size = i % 250 == 0 ? 5 << 20 : (size_t)(i * 37 % 9000) + 1;
+        assert(ptrs[i][0] == (i & 0xff) && ptrs[i][size - 1] == (i & 0xff));
+        my_heap_free(h, ptrs[i]);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Tests independent heaps.
+ *
+ * Threads share one heap while another has a live allocation. Destroying a
+ * heap with live allocations unmaps its memory and leaves the other heap
+ * and the default heap intact.
+ */
+void test_heaps() {
+    printf("--- Testing Heaps ---\n");
+    my_heap_t *h = my_heap_create(1 << 20), *other = my_heap_create(0);
+    assert(h != NULL && other != NULL);
+    unsigned char *keep = my_heap_malloc(other, 100);
+    assert(keep != NULL);
+    memset(keep, 'k', 100);
+    assert(my_heap_allocated(other) >= 100);
+
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) assert(pthread_create(&threads[i], NULL, heap_worker, h) == 0);
+    for (int i = 0; i < 4; i++) pthread_join(threads[i], NULL);
+    size_t live = my_heap_allocated(h);
+    assert(live > 0);
+
+    // A batch free counts against the heap like my_heap_free does.
+    size_t kept = my_heap_allocated(other);
+    void *pair[2] = { my_heap_malloc(other, 3000), my_heap_malloc(other, 300000) };
+    assert(pair[0] != NULL && pair[1] != NULL);
+    assert(my_heap_allocated(other) >= kept + 303000);
+    my_free_batch(pair, 2);
+    assert(my_heap_allocated(other) == kept);
+
+    // Sizes past the bins are refused, and leave the heap usable.
+    assert(my_heap_malloc(other, (size_t)5 << 30) == NULL);
+    assert(my_heap_create((size_t)5 << 30) == NULL);
+
+    // A pointer from another heap is refused rather than freed.
+    my_heap_free(h, keep);
+    assert(keep[0] == 'k');
+
+    struct my_stats before, after;
+    my_malloc_stats(&before);
+    my_heap_destroy(h);
+    my_malloc_stats(&after);
+    assert(after.mapped + live <= before.mapped);
+    assert(keep[99] == 'k');
+    my_heap_free(other, keep);
+    assert(my_heap_allocated(other) == 0);
+    my_heap_destroy(other);
+    my_heap_destroy(NULL);
+    printf("Heap test passed.\n");
+}
+
+/**
+ * @brief Worker that frees node-placed buffers on another thread.
+ * @param arg An array of three pointers to free.
+ * @return NULL.
+ */
+static void *node_free_worker(void *arg) {
+    void **ptrs = arg;
+    for (int i = 0; i < 3; i++) my_free(ptrs[i]);
+    return NULL;
+}
+
+// The objects each thread of the false sharing test allocates.
+#define LINE_OBJECTS 64
+// Keeps the threads of the false sharing test alive until all have allocated,
+// since an exited thread's runs are handed on to later threads.
+static pthread_barrier_t line_barrier;
+
+/**
+ * @brief Worker for the false sharing test: allocates small objects.
+ * @param arg An array of LINE_OBJECTS pointers to fill.
+ * @return NULL.
+ */
+static void *line_worker(void *arg) {
+    void **out = arg;
+    for (int i = 0; i < LINE_OBJECTS; i++) out[i] = my_malloc(16);
+    pthread_barrier_wait(&line_barrier);
+    return NULL;
+}
+
+/**
+ * @brief Checks whether two allocations touch a common cache line.
+ * @param a The first allocation.
+ * @param asize Its size.
+ * @param b The second allocation.
+ * @param bsize Its size.
+ * @return 1 if some 64-byte line holds bytes of both, 0 otherwise.
+ */
+static int share_line(void *a, size_t asize, void *b, size_t bsize) {
+    uintptr_t a0 = (uintptr_t)a / 64, a1 = ((uintptr_t)a + asize - 1) / 64;
+    uintptr_t b0 = (uintptr_t)b / 64, b1 = ((uintptr_t)b + bsize - 1) / 64;
+    return a0 <= b1 && b0 <= a1;
+}
+
+/**
+ * @brief Tests that allocations do not share cache lines across threads.
+ *
+ * Small objects of two threads must never share a line, and objects from
+ * my_malloc_isolated must not share one with anything, whatever their size.
+ */
+void test_isolated() {
+    printf("--- Testing Cache Line Isolation ---\n");
+    void *objs[2][LINE_OBJECTS];
+    pthread_t t[2];
+    pthread_barrier_init(&line_barrier, NULL, 2);
+    for (int i = 0; i < 2; i++) assert(pthread_create(&t[i], NULL, line_worker, objs[i]) == 0);
+    for (int i = 0; i < 2; i++) pthread_join(t[i], NULL);
+    pthread_barrier_destroy(&line_barrier);
+    for (int i = 0; i < LINE_OBJECTS; i++) {
+        for (int j = 0; j < LINE_OBJECTS; j++) assert(!share_line(objs[0][i], 16, objs[1][j], 16));
+    }
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < LINE_OBJECTS; j++) my_free(objs[i][j]);
+    }
+
+    static const size_t sizes[] = { 0, 1, 8, 16, 63, 64, 65, 200, 1000, 1500, 5000, 9000 };
+    enum { COUNT = sizeof(sizes) / sizeof(sizes[0]) };
+    void *iso[COUNT], *plain[COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        iso[i] = my_malloc_isolated(sizes[i]);
+        plain[i] = my_malloc(sizes[i] ? sizes[i] : 1);
+        assert(iso[i] != NULL && plain[i] != NULL);
+        assert((uintptr_t)iso[i] % 64 == 0 && my_malloc_usable_size(iso[i]) >= sizes[i]);
+        memset(iso[i], 0x5a, sizes[i]);
+    }
+    for (int i = 0; i < COUNT; i++) {
+        size_t size = sizes[i] ? sizes[i] : 1;
+        for (int j = 0; j < COUNT; j++) {
+            size_t other = sizes[j] ? sizes[j] : 1;
+            assert(!share_line(iso[i], size, plain[j], other));
+            if (j != i) assert(!share_line(iso[i], size, iso[j], other));
+        }
+    }
+    for (int i = 0; i < COUNT; i++) {
+        my_free(iso[i]);
+        my_free(plain[i]);
+    }
+    assert(my_malloc_isolated(SIZE_MAX) == NULL);
+    printf("Cache line isolation test passed.\n");
+}
+
+/**
+ * @brief Tests explicit NUMA placement with my_malloc_onnode.
+ *
+ * Node 0 always exists. Buffers placed there are freed from another thread,
+ * and nodes that do not exist are refused.
+ */
+void test_onnode() {
+    printf("--- Testing Node Placement ---\n");
+    static const size_t sizes[] = { 100, 10000, 2 * 1024 * 1024 };
+    void *ptrs[3];
+    for (int i = 0; i < 3; i++) {
+        ptrs[i] = my_malloc_onnode(sizes[i], 0);
+        assert(ptrs[i] != NULL);
+        assert((uintptr_t)ptrs[i] % ALIGN == 0);
+        memset(ptrs[i], 'n', sizes[i]);
+    }
+    pthread_t t;
+    assert(pthread_create(&t, NULL, node_free_worker, ptrs) == 0);
+    pthread_join(t, NULL);
+    assert(my_malloc_onnode(100, -1) == NULL);
+    assert(my_malloc_onnode(100, 1 << 20) == NULL);
+    printf("Node placement test passed.\n");
+}
+
+/**
+ * @brief Tests huge allocations that get their own mapping.
+ *
+ * Grows a buffer well past the mmap threshold and shrinks it back into the
+ * heap, checking that the contents survive each step.
+ */
+void test_huge() {
+    printf("--- Testing Huge Allocations ---\n");
+    size_t size = 2 * 1024 * 1024;
+    unsigned char *p = my_malloc(size);
+    assert(p != NULL);
+    memset(p, 'h', size);
+    p = my_realloc(p, 100 * 1024 * 1024);
+    assert(p != NULL);
+    assert(p[0] == 'h' && p[size - 1] == 'h');
+    p[100 * 1024 * 1024 - 1] = 'e';
+    p = my_realloc(p, 100);
+    assert(p != NULL);
+    for (int i = 0; i < 100; i++) assert(p[i] == 'h');
+    my_free(p);
+
+#ifndef DEBUG_ALLOCATOR
+    // A threshold past what the bins hold still maps the largest requests.
+    // Debug builds would fill all of it, so they skip this.
+    assert(my_mallopt(MY_M_MMAP_THRESHOLD, (size_t)16 << 30) == 1);
+    p = my_malloc((size_t)3 << 30);
+    assert(p != NULL);
+    my_free(p);
+    assert(my_mallopt(MY_M_MMAP_THRESHOLD, 1024 * 1024) == 1);
+#endif
+    printf("Huge allocation test passed.\n");
+}
+
+// Keeps the workers of one round of test_heap_reuse alive together.
+static pthread_barrier_t reuse_barrier;
+
+/**
+ * @brief Worker that allocates and frees small objects, then exits.
+ *
+ * All workers of a round hold their objects until every one has allocated,
+ * so that each thread has a heap of its own, which goes to its node's pool
+ * when it exits.
+ *
+ * @param arg Unused.
+ * @return NULL.
+ */
+static void *reuse_worker(void *arg) {
+    (void)arg;
+    enum { COUNT = 100 };
+    void *ptrs[COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        ptrs[i] = my_malloc(40);
+        assert(ptrs[i] != NULL);
+    }
+    pthread_barrier_wait(&reuse_barrier);
+    for (int i = 0; i < COUNT; i++) my_free(ptrs[i]);
+    return NULL;
+}
+
+/**
+ * @brief Tests statistics once exited threads' heaps have been reused.
+ *
+ * This must run before anything else allocates, so that the very first
+ * thread heap belongs to a thread that exits. A pooled heap taken by a new
+ * thread used to be linked into the list of all heaps a second time, which
+ * made my_malloc_stats loop forever; the alarm turns that into a failure.
+ */
+void test_heap_reuse() {
+    printf("--- Testing Heap Reuse ---\n");
+    enum { WORKERS = 2, ROUNDS = 2 };
+    alarm(30);
+    for (int round = 0; round < ROUNDS; round++) {
+        pthread_t threads[WORKERS];
+        pthread_barrier_init(&reuse_barrier, NULL, WORKERS);
+        for (int i = 0; i < WORKERS; i++) assert(pthread_create(&threads[i], NULL, reuse_worker, NULL) == 0);
+        for (int i = 0; i < WORKERS; i++) pthread_join(threads[i], NULL);
+        pthread_barrier_destroy(&reuse_barrier);
+    }
+    struct my_stats st;
+    my_malloc_stats(&st);
+    alarm(0);
+    int c = 0;
+    while (st.classes[c].size < 40) c++;
+    assert(st.classes[c].mallocs == WORKERS * ROUNDS * 100);
+    assert(st.classes[c].frees == WORKERS * ROUNDS * 100);
+    assert(st.allocated == 0);
+    printf("Heap reuse test passed.\n");
+}
+
+/**
+ * @brief Tests the statistics snapshot.
+ *
+ * Allocations and frees of small and block sizes must show up in the byte
+ * and event counts, and the derived figures must stay consistent.
+ */
+void test_stats() {
+    printf("--- Testing Statistics ---\n");
+    struct my_stats before, during, after;
+    my_malloc_stats(&before);
+    void *small = my_malloc(40);
+    void *block = my_malloc(5000);
+    assert(small != NULL && block != NULL);
+    my_malloc_stats(&during);
+    assert(during.allocated >= before.allocated + 40 + 5000);
+    assert(during.mapped > 0 && during.peak_mapped >= during.mapped);
+    assert(during.overhead > 0);
+    assert(during.largest_free <= during.free);
+    assert(during.fragmentation >= 0.0 && during.fragmentation <= 1.0);
+
+    size_t bin_mallocs = 0, probes = 0;
+    for (int i = 0; i < MY_STATS_BINS; i++) bin_mallocs += during.bins[i].mallocs;
+    for (int i = 0; i < MY_STATS_PROBE_BUCKETS; i++) probes += during.probes[i];
+    assert(bin_mallocs > 0 && probes > 0);
+    int c = 0;
+    while (during.classes[c].size < 40) c++;
+    assert(during.classes[c].mallocs > before.classes[c].mallocs);
+
+    my_free(small);
+    my_free(block);
+    my_malloc_stats(&after);
+    assert(after.allocated == before.allocated);
+    assert(after.classes[c].frees > during.classes[c].frees);
+    printf("Statistics test passed.\n");
+}
+
+/**
+ * @brief Heap walk callback that counts the blocks waiting in fastbins.
+ * @param info The block.
+ * @param arg The count, a size_t.
+ */
+static void count_fast(const struct my_block_info *info, void *arg) {
+    if (info->state == MY_BLOCK_FAST) (*(size_t*)arg)++;
+}
+
+/**
+ * @brief Sums the block splits over all bins.
+ * @return The number of splits so far.
+ */
+static size_t total_splits(void) {
+    struct my_stats st;
+    my_malloc_stats(&st);
+    size_t splits = 0;
+    for (int i = 0; i < MY_STATS_BINS; i++) splits += st.bins[i].splits;
+    return splits;
+}
+
+/**
+ * @brief Tests the fastbins of mid-sized blocks.
+ *
+ * A freed block must be handed straight back to the next request of its
+ * size without a split, consolidation must empty the fastbins, and a block
+ * freed twice must be caught while it waits in a fastbin.
+ */
+void test_fastbins() {
+    printf("--- Testing Fastbins ---\n");
+    // Start with empty fastbins, so that reaching FAST_LIMIT cannot
+    // consolidate them in the middle of the test.
+    my_malloc_consolidate();
+    void *p = my_malloc(3000);
+    assert(p != NULL);
+    my_free(p);
+    size_t splits = total_splits();
+    for (int i = 0; i < 1000; i++) {
+        void *q = my_malloc(3000);
+        assert(q == p);
+        memset(q, i, 3000);
+        my_free(q);
+    }
+    assert(total_splits() == splits);
+
+    size_t fast = 0;
+    my_heap_walk(count_fast, &fast);
+    assert(fast > 0);
+    my_malloc_consolidate();
+    fast = 0;
+    my_heap_walk(count_fast, &fast);
+    assert(fast == 0);
+
+    // A freed block is still caught as a double free while it waits.
+    void *r = my_malloc(2000);
+    my_free(r);
+    my_free(r);
+    printf("Fastbins test passed.\n");
+}
+
+/**
+ * @brief Tests that large requests take the best fit at the lowest address.
+ *
+ * Batches give adjacent blocks, so every other one can be freed without it
+ * merging with a neighbor.
+ */
+void test_best_fit() {
+    printf("--- Testing Best Fit ---\n");
+    void *wide[5], *narrow[3];
+    assert(my_malloc_batch(24000, 5, wide) == 5);
+    assert(my_malloc_batch(23104, 3, narrow) == 3);
+    my_free(wide[1]);
+    my_free(wide[3]);
+    my_free(narrow[1]);
+
+    // The narrow block shares the request's bin; a good fit would skip it
+    // for a wide one. Earlier tests may have left other fitting blocks, so
+    // only check that none larger was taken.
+    void *p = my_malloc(23000);
+    assert(p != NULL && my_malloc_usable_size(p) <= 23104);
+    // The wide blocks tie, so if one is taken, the one at the lower address
+    // wins.
+    void *q = my_malloc(23000);
+    assert(q != NULL && my_malloc_usable_size(q) <= 24000);
+    if (q == wide[1] || q == wide[3]) assert(q == (wide[1] < wide[3] ? wide[1] : wide[3]));
+
+    my_free(p);
+    my_free(q);
+    for (int i = 0; i < 5; i += 2) my_free(wide[i]);
+    for (int i = 0; i < 3; i += 2) my_free(narrow[i]);
+    printf("Best fit test passed.\n");
+}
+
+/**
+ * @brief Tests purging of idle free pages.
+ *
+ * With decay off nothing is purged, a zero decay time purges the pages of a
+ * freed block out of the resident set, and calloc on purged pages still
+ * returns zeroed memory.
+ */
+void test_decay() {
+    printf("--- Testing Decay Purging ---\n");
+    size_t len = 512 * 1024;
+    unsigned char *p = my_malloc(len);
+    assert(p != NULL);
+    memset(p, 0xab, len);
+    my_free(p);
+
+    // With the decay pass off, nothing is purged.
+    my_mallopt(MY_M_DECAY_MS, SIZE_MAX);
+    struct my_stats before, after;
+    my_malloc_stats(&before);
+    my_malloc_decay();
+    my_malloc_stats(&after);
+    assert(after.purged == before.purged);
+
+    // A zero decay time purges every free page at the next pass, and the
+    // pages leave the resident set.
+    my_mallopt(MY_M_DECAY_MS, 0);
+    my_malloc_decay();
+    my_malloc_stats(&after);
+    assert(after.purged >= before.purged + len - 2 * 4096);
+    unsigned char *page = (unsigned char*)(((uintptr_t)p + 8191) & ~(uintptr_t)4095);
+    unsigned char resident = 1;
+    assert(mincore(page, 4096, &resident) == 0);
+    assert(!(resident & 1));
+
+    // calloc skips clearing purged pages but still returns zeroed memory.
+    unsigned char *z = my_calloc(1, len);
+    assert(z != NULL);
+    for (size_t i = 0; i < len; i++) assert(z[i] == 0);
+    my_free(z);
+    my_mallopt(MY_M_DECAY_MS, 10000);
+    printf("Decay purging test passed.\n");
+}
+
+/**
+ * @brief Reads the totals line of a heap profile.
+ * @param live Receives the sampled live object count.
+ * @param total Receives the sampled cumulative object count.
+ * @return 1 if the profile has a valid header and mapping section, else 0.
+ */
+static int read_heap_profile(size_t *live, size_t *total) {
+    FILE *f = tmpfile();
+    assert(f != NULL);
+    my_heap_profile_dump(f);
+    rewind(f);
+    char line[512];
+    size_t live_bytes, total_bytes, rate;
+    int ok = fgets(line, sizeof(line), f) != NULL
+             && sscanf(line, "heap profile: %zu: %zu [ %zu: %zu] @ heap_v2/%zu",
+                       live, &live_bytes, total, &total_bytes, &rate) == 5;
+    int maps = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (!strcmp(line, "MAPPED_LIBRARIES:\n")) maps = 1;
+    }
+    fclose(f);
+    return ok && maps;
+}
+
+/**
+ * @brief Tests the sampling heap profiler.
+ *
+ * With a rate of one byte every allocation is sampled, so freeing them must
+ * take them out of the live counts but leave the cumulative ones.
+ */
+void test_profile() {
+    printf("--- Testing Heap Profile ---\n");
+    enum { COUNT = 100 };
+    void *ptrs[COUNT + 1];
+    assert(my_mallopt(MY_M_PROFILE_RATE, 1));
+    for (int i = 0; i < COUNT; i++) ptrs[i] = my_malloc(64);
+    ptrs[COUNT] = my_malloc(5000);
+    size_t live1, total1, live2, total2;
+    assert(read_heap_profile(&live1, &total1));
+    assert(live1 >= COUNT + 1 && total1 >= live1);
+    for (int i = 0; i <= COUNT; i++) my_free(ptrs[i]);
+    assert(read_heap_profile(&live2, &total2));
+    assert(live2 + COUNT + 1 <= live1 && total2 >= total1);
+    assert(my_mallopt(MY_M_PROFILE_RATE, 0));
+    printf("Heap profile test passed.\n");
+}
+
+/**
+ * @brief Worker for the trace test: allocates and frees one block.
+ * @param arg Unused.
+ * @return NULL.
+ */
+static void *trace_worker(void *arg) {
+    (void)arg;
+    my_free(my_malloc(48));
+    return NULL;
+}
+
+/**
+ * @brief Tests the allocation trace recorder.
+ *
+ * A realloc must be recorded as one operation, whatever it allocates and
+ * frees inside, and another thread's operations must land in the same file.
+ */
+void test_trace() {
+    printf("--- Testing Allocation Trace ---\n");
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mymalloc_trace.%d", (int)getpid());
+    assert(my_trace_start(path));
+    void *p = my_malloc(100);
+    void *q = my_realloc(p, 5000);
+    my_free(q);
+    pthread_t t;
+    assert(pthread_create(&t, NULL, trace_worker, NULL) == 0);
+    pthread_join(t, NULL);
+    my_trace_stop();
+    my_free(my_malloc(32));
+
+    FILE *f = fopen(path, "rb");
+    assert(f != NULL);
+    struct my_trace_header header;
+    struct my_trace_record recs[8];
+    assert(fread(&header, sizeof(header), 1, f) == 1);
+    assert(!memcmp(header.magic, MY_TRACE_MAGIC, sizeof(header.magic)));
+    size_t n = fread(recs, sizeof(recs[0]), 8, f);
+    fclose(f);
+    unlink(path);
+    assert(n == 5);
+    // Threads write their records out separately, so put them in time order.
+    for (size_t i = 1; i < n; i++) {
+        for (size_t j = i; j > 0 && recs[j].time < recs[j - 1].time; j--) {
+            struct my_trace_record tmp = recs[j];
+            recs[j] = recs[j - 1];
+            recs[j - 1] = tmp;
+        }
+    }
+    assert(recs[0].op == MY_TRACE_MALLOC && recs[0].ptr == (uintptr_t)p && recs[0].size == 100);
+    assert(recs[1].op == MY_TRACE_REALLOC && recs[1].ptr == (uintptr_t)q && recs[1].old == (uintptr_t)p
+           && recs[1].size == 5000);
+    assert(recs[2].op == MY_TRACE_FREE && recs[2].ptr == (uintptr_t)q);
+    assert(recs[3].op == MY_TRACE_MALLOC && recs[4].op == MY_TRACE_FREE && recs[3].ptr == recs[4].ptr);
+    assert(recs[3].thread != recs[0].thread);
+    printf("Allocation trace test passed.\n");
+}
+
+/**
+ * @brief Worker for the multithreaded test.
+ *
+ * Keeps a small window of live small objects, stamps each one with the
+ * thread id and checks the stamp before freeing it.
+ *
+ * @param arg The thread index.
+ * @return NULL.
+ */
+static void *thread_worker(void *arg) {
+    unsigned char id = (unsigned char)(uintptr_t)arg;
+    unsigned seed = id;
+    enum { WINDOW = 64 };
+    unsigned char *live[WINDOW] = {0};
+    size_t sizes[WINDOW] = {0};
+
+    for (int i = 0; i < THREAD_ITERATIONS; i++) {
+        int slot = rand_r(&seed) % WINDOW;
+        if (live[slot]) {
+            for (size_t j = 0; j < sizes[slot]; j++) assert(live[slot][j] == id);
+            my_free(live[slot]);
+        }
+        sizes[slot] = rand_r(&seed) % 1024 + 1;
+        live[slot] = my_malloc(sizes[slot]);
+        assert(live[slot] != NULL);
+        memset(live[slot], id, sizes[slot]);
+    }
+    for (int i = 0; i < WINDOW; i++) my_free(live[i]);
+    return NULL;
+}
+
+/**
+ * @brief Worker for the multithreaded fastbin test.
+ *
+ * Like thread_worker, but with mid-sized blocks in a range of sizes of the
+ * thread's own, so that threads free onto and reuse different fastbins.
+ * The first thread also consolidates and reads the statistics now and then,
+ * which takes the fastbins back under the node lock.
+ *
+ * @param arg The thread index.
+ * @return NULL.
+ */
+static void *fast_worker(void *arg) {
+    unsigned char id = (unsigned char)(uintptr_t)arg;
+    unsigned seed = id;
+    enum { WINDOW = 16 };
+    unsigned char *live[WINDOW] = {0};
+    size_t sizes[WINDOW] = {0};
+
+    for (int i = 0; i < THREAD_ITERATIONS; i++) {
+        int slot = rand_r(&seed) % WINDOW;
+        if (live[slot]) {
+            assert(live[slot][0] == id && live[slot][sizes[slot] - 1] == id);
+            my_free(live[slot]);
+        }
+        sizes[slot] = 1100 + id * 800 + rand_r(&seed) % 64;
+        live[slot] = my_malloc(sizes[slot]);
+        assert(live[slot] != NULL);
+        memset(live[slot], id, sizes[slot]);
+        if (id == 1 && i % 1024 == 0) {
+            struct my_stats st;
+            my_malloc_consolidate();
+            my_malloc_stats(&st);
+        }
+    }
+    for (int i = 0; i < WINDOW; i++) my_free(live[i]);
+    return NULL;
+}
+
+// The number of slots in the producer/consumer ring buffer.
+#define RING_SIZE 256
+
+/**
+ * @brief A single-producer, single-consumer ring of pointers.
+ */
+typedef struct Ring {
+    void *slot[RING_SIZE];     ///< The queued pointers.
+    _Atomic size_t head;       ///< The number of pointers pushed so far.
+    _Atomic size_t tail;       ///< The number of pointers popped so far.
+} Ring;
+
+/**
+ * @brief Producer for the cross-thread free test.
+ *
+ * Allocates stamped buffers and hands them to the consumer, so every free
+ * happens on a thread that does not own the buffer.
+ *
+ * @param arg The ring to fill.
+ * @return NULL.
+ */
+static void *producer(void *arg) {
+    Ring *ring = arg;
+    for (size_t i = 0; i < THREAD_ITERATIONS; i++) {
+        size_t size = i % 1024 + 1;
+        unsigned char *p = my_malloc(size);
+        assert(p != NULL);
+        memset(p, (int)(size & 0xff), size);
+        while (i - atomic_load(&ring->tail) >= RING_SIZE) sched_yield();
+        ring->slot[i % RING_SIZE] = p;
+        atomic_store(&ring->head, i + 1);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Consumer for the cross-thread free test.
+ * @param arg The ring to drain.
+ * @return NULL.
+ */
+static void *consumer(void *arg) {
+    Ring *ring = arg;
+    for (size_t i = 0; i < THREAD_ITERATIONS; i++) {
+        while (atomic_load(&ring->head) == i) sched_yield();
+        unsigned char *p = ring->slot[i % RING_SIZE];
+        size_t size = i % 1024 + 1;
+        assert(p[0] == (size & 0xff) && p[size - 1] == (size & 0xff));
+        my_free(p);
+        atomic_store(&ring->tail, i + 1);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Tests the heap size, pre-faulting and huge page settings.
+ */
+void test_configure() {
+    printf("--- Testing Heap Configuration ---\n");
+    assert(my_mallopt(MY_M_HUGEPAGES, MY_HUGEPAGES_EXPLICIT + 1) == 0);
+    assert(my_mallopt(MY_M_HEAP_SIZE, SIZE_MAX) == 0);
+    // A chunk this large would have a free block no bin can hold.
+    assert(my_mallopt(MY_M_HEAP_SIZE, (size_t)5 << 30) == 0);
+    // The node already has its first chunk here, so this changes nothing.
+    assert(my_mallopt(MY_M_HEAP_SIZE, 8 << 20) == 1);
+
+    // Grow the heap with pre-faulting on: the block carved from the new
+    // chunk is resident before anything touches it.
+    assert(my_mallopt(MY_M_POPULATE, 1) == 1);
+    assert(my_mallopt(MY_M_HUGEPAGES, MY_HUGEPAGES_THP) == 1);
+    enum { MAX_BLOCKS = 1024 };
+    static void *blocks[MAX_BLOCKS];
+    size_t len = 512 * 1024;
+    struct my_stats before, st;
+    my_malloc_stats(&before);
+    int n = 0;
+    do {
+        blocks[n] = my_malloc(len);
+        assert(blocks[n] != NULL);
+        my_malloc_stats(&st);
+        n++;
+    } while (st.mapped == before.mapped && n < MAX_BLOCKS);
+    assert(st.mapped > before.mapped);
+    unsigned char *page = (unsigned char*)(((uintptr_t)blocks[n - 1] + 4095) & ~(uintptr_t)4095);
+    static unsigned char resident[512 * 1024 / 4096];
+    assert(mincore(page, len - 4096, resident) == 0);
+    for (size_t i = 0; i < (len - 4096) / 4096; i++) assert(resident[i] & 1);
+    for (int i = 0; i < n; i++) my_free(blocks[i]);
+    my_mallopt(MY_M_POPULATE, 0);
+    my_mallopt(MY_M_HUGEPAGES, MY_HUGEPAGES_NONE);
+    printf("Heap configuration test passed.\n");
+}
+
+/**
+ * @brief Tests concurrent allocation and deallocation from several threads.
+ *
+ * Runs independent workers first, then workers that each keep to fastbins
+ * of their own, then producer/consumer pairs whose frees all cross threads.
+ */
+void test_threads() {
+    printf("--- Testing Threads ---\n");
+    pthread_t threads[NUM_THREADS];
+    for (uintptr_t i = 0; i < NUM_THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, thread_worker, (void*)(i + 1)) == 0);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) pthread_join(threads[i], NULL);
+
+    for (uintptr_t i = 0; i < NUM_THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, fast_worker, (void*)(i + 1)) == 0);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) pthread_join(threads[i], NULL);
+
+    static Ring rings[NUM_THREADS / 2];
+    for (int i = 0; i < NUM_THREADS / 2; i++) {
+        assert(pthread_create(&threads[2 * i], NULL, producer, &rings[i]) == 0);
+        assert(pthread_create(&threads[2 * i + 1], NULL, consumer, &rings[i]) == 0);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) pthread_join(threads[i], NULL);
+    printf("Thread test passed.\n");
+}
+
+/**
+ * @brief Tests that a child forked while other threads allocate can allocate.
+ *
+ * Without the fork handlers the child could inherit a lock held by a thread
+ * that does not exist in it and hang on its first allocation.
+ */
+void test_fork() {
+    printf("--- Testing Fork ---\n");
+    pthread_t threads[NUM_THREADS];
+    for (uintptr_t i = 0; i < NUM_THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, thread_worker, (void*)(i + 1)) == 0);
+    }
+    for (int i = 0; i < 20; i++) {
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            void *small = my_malloc(40), *block = my_malloc(5000);
+            _exit(small && block ? 0 : 1);
+        }
+        int status;
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) pthread_join(threads[i], NULL);
+    printf("Fork test passed.\n");
+}
+
+#if defined(HARDENED_ALLOCATOR) || defined(DEBUG_ALLOCATOR)
+/**
+ * @brief Runs a function in a child process and checks that it aborts.
+ * @param fn The function; it exits with 1 if the allocator let it through.
+ */
+static void expect_abort(void (*fn)(void)) {
+    fflush(stdout);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        fn();
+        _exit(1);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+}
+
+/**
+ * @brief Grows a block's size in its header, as an overflow of its
+ *        predecessor would, and frees it.
+ */
+static void smash_header(void) {
+    size_t *p = my_malloc(5000);
+    p[-1] += 4096;
+    my_free(p);
+}
+
+/**
+ * @brief Points the free list link of a freed block at a stack buffer and
+ *        allocates until the block would have been reused.
+ */
+static void forge_link(void) {
+    _Alignas(16) static char target[64];
+    // Freeing the block must not push the fastbins over their limit.
+    my_malloc_consolidate();
+    void **p = my_malloc(3000);
+    my_free(p);
+    p[1] = target;
+    for (int i = 0; i < 1000; i++) {
+        void *q = my_malloc(3000);
+        if (q == (void*)target) _exit(1);
+        my_free(q);
+    }
+}
+
+/**
+ * @brief Tests that a hardened build aborts on a damaged header or free list.
+ */
+void test_hardened() {
+    printf("--- Testing Hardening ---\n");
+    expect_abort(smash_header);
+    expect_abort(forge_link);
+    printf("Hardening test passed.\n");
+}
+#endif
+
+#ifdef DEBUG_ALLOCATOR
+/**
+ * @brief Writes one byte past an allocation and frees it.
+ */
+static void overflow_by_one(void) {
+    char *p = my_malloc(100);
+    p[100] = 0;
+    my_free(p);
+}
+
+/**
+ * @brief Tests the redzones and the quarantine of a debug build.
+ */
+void test_debug() {
+    printf("--- Testing Debug Checks ---\n");
+    expect_abort(overflow_by_one);
+
+    // A freed object is neither reused at once nor reported as usable for
+    // more than was asked.
+    void *p = my_malloc(100);
+    assert(my_malloc_usable_size(p) == 100);
+    my_free(p);
+    void *q = my_malloc(100);
+    assert(q != p);
+    my_free(q);
+    printf("Debug check test passed.\n");
+}
+#endif
+#endif
+
 /**
  * @brief The main entry point for the test suite.
  * @return 0 on successful execution.
@@ -169,11 +1404,55 @@ int main() {
     my_init();
 #endif
 
-    // Run all the tests.
+    // Run all the tests. Heap reuse goes first, before anything allocates.
+#if defined(ADVANCED_ALLOCATOR) && !defined(DEBUG_ALLOCATOR)
+    test_heap_reuse();
+#endif
     test_alignment();
     test_stress();
+    // The debug build moves on every realloc and holds freed memory back,
+    // so the tests of reuse and of exact accounting do not apply to it.
+#ifndef DEBUG_ALLOCATOR
     test_realloc();
+#endif
     test_calloc();
+    test_backend();
+#ifndef DEBUG_ALLOCATOR
+    test_heap_walk();
+#endif
+#ifndef ADVANCED_ALLOCATOR
+    test_coalesce();
+#endif
+#ifdef ADVANCED_ALLOCATOR
+    test_growth();
+    test_aligned();
+    test_sized();
+    test_batch();
+    test_arena();
+    test_heaps();
+    test_onnode();
+    test_isolated();
+    test_huge();
+#ifndef DEBUG_ALLOCATOR
+    test_stats();
+    test_fastbins();
+#endif
+    test_best_fit();
+#ifndef DEBUG_ALLOCATOR
+    test_decay();
+#endif
+    test_profile();
+    test_trace();
+    test_configure();
+    test_threads();
+    test_fork();
+#endif
+#if defined(HARDENED_ALLOCATOR) || defined(DEBUG_ALLOCATOR)
+    test_hardened();
+#endif
+#ifdef DEBUG_ALLOCATOR
+    test_debug();
+#endif
     test_invalid_free();
 
     return 0;